@@ -29,4 +29,80 @@ inline void wait(uint32_t cycles) {
     for(uint32_t i = 0; i < cycles; i++) {
         asm volatile("nop");
     }
-}
\ No newline at end of file
+}
+
+// CPU identification / control registers / MSRs
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    __asm__ volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+/* the control registers are register-width, uintptr_t keeps these
+   assembling in the 64-bit hosted build (where nothing calls them) */
+static inline uint32_t read_cr0(void) {
+    uintptr_t v;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(v));
+    return (uint32_t)v;
+}
+
+static inline void write_cr0(uint32_t v) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"((uintptr_t)v) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uintptr_t v;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(v));
+    return (uint32_t)v;
+}
+
+static inline void write_cr4(uint32_t v) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"((uintptr_t)v) : "memory");
+}
+
+static inline void write_cr3(uint32_t v) {
+    __asm__ volatile ("mov %0, %%cr3" : : "r"((uintptr_t)v) : "memory");
+}
+
+static inline void invlpg(void* addr) {
+    __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static inline void wbinvd(void) {
+    __asm__ volatile ("wbinvd" : : : "memory");
+}
+
+// spin-wait hint (rep nop, so any i386 takes it)
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+// interrupts off, returning the previous EFLAGS for irq_restore(). The hosted
+// build has no interrupts to mask (and cli would fault in user mode)
+static inline uintptr_t irq_save(void) {
+#ifdef HOSTED
+    return 0;
+#else
+    uintptr_t flags;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+#endif
+}
+
+static inline void irq_restore(uintptr_t flags) {
+#ifdef HOSTED
+    (void)flags;
+#else
+    __asm__ volatile ("push %0; popf" : : "r"(flags) : "memory", "cc");
+#endif
+}
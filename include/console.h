@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+// Console sinks (libc/text.c): everything printf() formats goes to every
+// registered sink whose level lets it through. The framebuffer text console
+// is always there as "fb", drivers add more (serial.c adds "com1").
+
+// log levels, lower is more important. printf() prints at LOG_INFO,
+// DEBUG_PRINT at LOG_DEBUG
+#define LOG_ERR     0
+#define LOG_WARN    1
+#define LOG_INFO    2
+#define LOG_DEBUG   3
+
+typedef struct console_sink {
+    const char* name;
+    void (*write)(const char* s, size_t n);
+    int level;                      // passes output at this level and below
+    struct console_sink* next;
+} console_sink_t;
+
+// add a sink (static storage, it is never removed)
+void console_register(console_sink_t* sink);
+console_sink_t* console_find(const char* name);
+
+// list the sinks and their levels (loglevel command)
+void console_info(void);
+
+int printk(int level, const char* fmt, ...);
+int vprintk(int level, const char* fmt, va_list ap);
@@ -0,0 +1,129 @@
+#pragma once
+#include <stdint.h>
+
+// CPU identification (cpu.c): CPUID is read once at boot into cpu_features,
+// everything else asks cpu_has(). Features the kernel has not switched on
+// (AVX without XSAVE state, ...) are cleared, so a set bit means usable.
+
+// word 0: leaf 1 EDX, 1: leaf 1 ECX, 2: leaf 7 EBX, 3: leaf 7 EDX,
+// 4: leaf 0x80000001 EDX
+#define CPU_WORDS 5
+#define CPU_FEATURE(word, bit) ((word) * 32 + (bit))
+
+#define CPU_FPU     CPU_FEATURE(0, 0)
+#define CPU_PSE     CPU_FEATURE(0, 3)
+#define CPU_TSC     CPU_FEATURE(0, 4)
+#define CPU_MSR     CPU_FEATURE(0, 5)
+#define CPU_PAE     CPU_FEATURE(0, 6)
+#define CPU_APIC    CPU_FEATURE(0, 9)
+#define CPU_MTRR    CPU_FEATURE(0, 12)
+#define CPU_PGE     CPU_FEATURE(0, 13)
+#define CPU_CMOV    CPU_FEATURE(0, 15)
+#define CPU_PAT     CPU_FEATURE(0, 16)
+#define CPU_CLFLUSH CPU_FEATURE(0, 19)
+#define CPU_MMX     CPU_FEATURE(0, 23)
+#define CPU_FXSR    CPU_FEATURE(0, 24)
+#define CPU_SSE     CPU_FEATURE(0, 25)
+#define CPU_SSE2    CPU_FEATURE(0, 26)
+#define CPU_SSE3    CPU_FEATURE(1, 0)
+#define CPU_SSSE3   CPU_FEATURE(1, 9)
+#define CPU_SSE41   CPU_FEATURE(1, 19)
+#define CPU_SSE42   CPU_FEATURE(1, 20)
+#define CPU_POPCNT  CPU_FEATURE(1, 23)
+#define CPU_XSAVE   CPU_FEATURE(1, 26)
+#define CPU_OSXSAVE CPU_FEATURE(1, 27)
+#define CPU_AVX     CPU_FEATURE(1, 28)
+#define CPU_BMI1    CPU_FEATURE(2, 3)
+#define CPU_AVX2    CPU_FEATURE(2, 5)
+#define CPU_BMI2    CPU_FEATURE(2, 8)
+#define CPU_ERMS    CPU_FEATURE(2, 9)
+#define CPU_FSRM    CPU_FEATURE(3, 4)
+#define CPU_NX      CPU_FEATURE(4, 20)
+#define CPU_LM      CPU_FEATURE(4, 29)
+
+typedef struct {
+    char vendor[13];
+    char brand[49];
+    uint32_t max_leaf;
+    uint32_t max_ext_leaf;
+    uint32_t family, model, stepping;
+    uint32_t words[CPU_WORDS];
+} cpu_features_t;
+
+extern cpu_features_t cpu_features;
+
+// set once SSE is on: the IRQ stubs (idt.c) then FXSAVE/FXRSTOR around their
+// handlers, so the SSE string functions may run from interrupts
+extern uint8_t irq_fxsave;
+
+static inline int cpu_has(unsigned int feature) {
+    return (cpu_features.words[feature / 32] >> (feature % 32)) & 1;
+}
+
+// detect, switch on SSE, patch the alternatives. First thing main() does
+void cpu_init(void);
+
+// the parts of cpu_init() that do not need ring 0 (the hosted build uses them)
+void cpu_detect(void);
+void alternatives_apply(void);
+
+// vendor, model and feature flags (cpuinfo command)
+void cpu_info(void);
+
+/*
+ * Alternatives: a function that has several implementations gets a 5 byte
+ * "jmp rel32" entry point instead of a body, plus one record per candidate in
+ * the altinstr section. alternatives_apply() rewrites each jump once at boot
+ * to the last listed candidate whose feature the CPU has, so callers pay one
+ * direct, perfectly predicted jump and nothing else.
+ *
+ *     ALT_ENTRY(memcpy, memcpy_words);               // default
+ *     ALTERNATIVE(memcpy, memcpy_erms, CPU_ERMS);
+ *     ALTERNATIVE(memcpy, memcpy_sse2, CPU_SSE2);    // preferred over ERMS
+ *
+ * Implementations are plain functions with the same signature; static ones
+ * need ALT_IMPL so they are emitted under their own name.
+ */
+typedef struct {
+    uintptr_t site;
+    uintptr_t target;
+    uintptr_t feature;
+} alt_instr_t;
+
+#if defined(__x86_64__)
+#define ALT_PTR ".quad"
+#define ALT_ALIGN "8"
+#else
+#define ALT_PTR ".long"
+#define ALT_ALIGN "4"
+#endif
+#define ALT_STR_(x) #x
+#define ALT_STR(x) ALT_STR_(x)
+
+#define ALT_IMPL __attribute__((used, noinline))
+
+/* lets a function use SSE2 (inline asm with xmm operands) in a -m32 build,
+   only ever reached through an ALTERNATIVE on CPU_SSE2 */
+#define SSE2_FN __attribute__((target("sse2")))
+
+/* one level of indirection so macro names (the hosted build renames the
+   libc functions) are expanded before they are stringified */
+#define ALT_ENTRY(name, fallback) ALT_ENTRY_(name, fallback)
+#define ALTERNATIVE(name, impl, feature) ALTERNATIVE_(name, impl, feature)
+
+#define ALT_ENTRY_(name, fallback)                                  \
+    __asm__(".pushsection .text\n"                                  \
+            ".globl " #name "\n"                                    \
+            ".type " #name ", @function\n"                          \
+            ".balign 16\n"                                          \
+            #name ":\n"                                             \
+            ".byte 0xe9\n"                                          \
+            ".long " #fallback " - . - 4\n"                         \
+            ".size " #name ", 5\n"                                  \
+            ".popsection")
+
+#define ALTERNATIVE_(name, impl, feature)                           \
+    __asm__(".pushsection altinstr, \"a\"\n"                        \
+            ".balign " ALT_ALIGN "\n"                               \
+            ALT_PTR " " #name ", " #impl ", " ALT_STR(feature) "\n" \
+            ".popsection")
@@ -51,8 +51,11 @@
 
 #define GLOBAL_DEBUG 1
 
+#include <console.h>
+#include <klog.h>
+
 #if GLOBAL_DEBUG
-    #define DEBUG_PRINT(fmt, ...) printf(fmt, ##__VA_ARGS__)
+    #define DEBUG_PRINT(fmt, ...) klog(LOG_DEBUG, fmt, ##__VA_ARGS__)
 #else
     #define DEBUG_PRINT(fmt, ...) ((void)0)
 #endif
\ No newline at end of file
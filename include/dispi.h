@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+
+// Bochs / QEMU std-vga display interface (modules/video/dispi.c), the
+// registers behind ports 0x1CE/0x1CF that the BIOS set the VBE mode through.
+
+// if the current mode is a DISPI one, make the virtual framebuffer rows
+// scanlines tall (same pitch) and scan out from row 0; returns the rows
+// available, at most rows, 0 when there is no DISPI or the mode is not its
+int dispi_init(int rows);
+
+// scan out from row y of the virtual framebuffer
+void dispi_set_y_offset(int y);
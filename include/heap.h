@@ -0,0 +1,44 @@
+#pragma once
+#include <stddef.h>
+
+// Kernel heap (libc/malloc.c), a TLSF allocator: O(1) malloc/free with
+// immediate coalescing of physical neighbours.
+
+// Allocation granularity, compile-time configurable (-DMALLOC_ALIGN_LOG2=4
+// for 16 byte aligned blocks). Every pointer malloc() returns is aligned to it.
+#ifndef MALLOC_ALIGN_LOG2
+#define MALLOC_ALIGN_LOG2 3
+#endif
+#define MALLOC_ALIGN (1u << MALLOC_ALIGN_LOG2)
+
+// Instrumentation, also compile-time: HEAP_STATS keeps counters (a handful of
+// adds per call), HEAP_TRACK_CALLERS stores the return address of the
+// allocating call in every block header (costs one word per block).
+#ifndef HEAP_STATS
+#define HEAP_STATS 1
+#endif
+#ifndef HEAP_TRACK_CALLERS
+#define HEAP_TRACK_CALLERS 0
+#endif
+
+// hand a chunk of memory to the heap, it never gets it back
+void heap_add_pool(void* mem, size_t bytes);
+
+// malloc with a stronger alignment than MALLOC_ALIGN (power of two)
+void* aligned_alloc(size_t alignment, size_t size);
+
+// bytes actually usable behind ptr (at least what was asked for)
+size_t malloc_usable_size(void* ptr);
+
+// malloc that also reports the usable size, so growing buffers can use all of it
+void* malloc_sized(size_t size, size_t* usable);
+
+// free with the size the caller allocated (or the usable size reported for it),
+// debug builds complain when it does not match the block
+void free_sized(void* ptr, size_t size);
+
+// size of the biggest block malloc could hand out without growing the heap
+size_t heap_largest_free(void);
+
+// live/peak bytes, size histogram, fragmentation, call sites (heapstat command)
+void heap_print_stats(void);
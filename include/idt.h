@@ -21,6 +21,12 @@
 
 #define KBD_DATA     0x60
 
+// PIT channel 0 drives IRQ0: timer_ticks and the framebuffer flush
+#define PIT_CHANNEL0  0x40
+#define PIT_COMMAND   0x43
+#define PIT_BASE_HZ   1193182u
+#define PIT_HZ        100
+
 typedef struct {
     uint16_t offset_low;
     uint16_t selector;
@@ -38,6 +44,9 @@ extern void load_idt(idt_t(*));
 void set_idt(idt_entry_t* idt, int n, uint32_t handler, uint16_t sel, uint8_t flags);
 void init_idt(idt_entry_t* idt);
 void pic_init(void);
+void pit_init(uint32_t hz);
+
+extern volatile uint32_t timer_ticks;
 
 // ISR function pointer type
 typedef void (*isr_t)(void);
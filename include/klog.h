@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+// Kernel log (klog.c): a ring of fixed-size records. A writer reserves its
+// slot with one atomic add and formats straight into it, nothing is drawn,
+// so logging is safe from interrupt handlers (their stubs save the SSE state
+// the string functions use) and cheap enough to leave on.
+// The console sees the records later, when klog_drain() runs (the shell
+// loop calls it while idle) or through the dmesg command.
+
+#ifndef KLOG_RECORDS
+#define KLOG_RECORDS 1024       // power of two, 128 bytes each, from the heap
+#endif
+#define KLOG_EARLY_RECORDS 32   // static, until klog_init()
+#define KLOG_TAG_LEN  11
+#define KLOG_TEXT_LEN 108
+
+typedef struct {
+    volatile uint32_t seq;      // sequence number + 1 once complete, 0 while written
+    uint32_t ticks;             // timer_ticks when logged
+    uint8_t level;              // LOG_* from console.h
+    char tag[KLOG_TAG_LEN];     // subsystem, from a leading "[tag]" in the text
+    char text[KLOG_TEXT_LEN];   // formatted, truncated, no trailing newline
+} klog_record_t;
+
+// swap the early slots for the full ring once malloc works (after
+// pmm_init()), keeping what was logged so far
+void klog_init(void);
+
+void klog(int level, const char* fmt, ...);
+void vklog(int level, const char* fmt, va_list ap);
+
+// print the records logged since the last drain to the console sinks (each
+// at its own level); does nothing while draining is off
+void klog_drain(void);
+void klog_set_drain(int on);
+
+// print everything still in the ring (dmesg command)
+void klog_dump(void);
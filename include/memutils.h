@@ -1,2 +1,2 @@
 #pragma once
-void memdump(const void *addr, size_t size);
\ No newline at end of file
+void memdump(const void *addr, size_t size);
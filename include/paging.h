@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Paging (mm/paging.c): RAM is identity mapped with 4 MB PSE pages, write
+// back. Device memory has to be mapped explicitly with the caching it needs.
+
+#define LARGE_PAGE_SIZE 0x400000u
+
+typedef enum {
+    CACHE_WB,   // write back, normal RAM
+    CACHE_WT,   // write through
+    CACHE_UC,   // uncached, device registers
+    CACHE_WC,   // write combining, framebuffers
+} cache_type_t;
+
+// call once after pmm_init(), also maps the VESA framebuffer (all of video
+// memory) write-combining
+void paging_init(void);
+
+// identity map [phys, phys + size) with the given caching (4 MB granular),
+// returns the address to use or NULL
+void* mmio_map(uint32_t phys, uint32_t size, cache_type_t type);
+void mmio_unmap(void* addr, uint32_t size);
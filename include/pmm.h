@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Physical page frame allocator (mm/pmm.c), a binary buddy allocator over the
+// usable RAM the BIOS reported through E820.
+
+#define PAGE_SIZE       4096u
+#define PMM_MAX_ORDER   12      /* biggest block: 4 KiB << 12 = 16 MiB */
+
+// E820 map as left behind by entry.s
+#define E820_COUNT_ADDR 0x500
+#define E820_MAP_ADDR   0x504
+#define E820_MAX        128
+
+#define E820_USABLE     1
+#define E820_RESERVED   2
+#define E820_ACPI       3
+#define E820_NVS        4
+#define E820_BAD        5
+
+typedef struct __attribute__((packed)) {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t acpi;
+} e820_entry_t;
+
+void pmm_init(const e820_entry_t* map, uint32_t count);
+
+// 2^order contiguous pages, aligned to their size. NULL when out of memory
+void* pmm_alloc_pages(unsigned int order);
+void pmm_free_pages(void* addr, unsigned int order);
+
+// end of the highest RAM page the allocator manages
+uintptr_t pmm_top(void);
+size_t pmm_total_bytes(void);
+size_t pmm_free_bytes(void);
+
+// print the E820 map and per-order free lists (meminfo command)
+void pmm_info(void);
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <vesa.h>
+
+// Filled and outlined shapes (modules/video/raster.c). Everything is cut
+// into horizontal spans for fb_span(), so a shape costs its area, and its
+// bounding box is reported as damage once. line() and circle() in vesa.h
+// are drawn here too.
+
+// vertices a polygon may have, more and nothing is drawn
+#ifndef RASTER_MAX_POINTS
+#define RASTER_MAX_POINTS 256
+#endif
+
+// coordinates and line widths past this (either sign) are not drawn, radii
+// past RASTER_MAX_RADIUS neither; the arithmetic stays within 64 bits
+#define RASTER_MAX_COORD  32767
+#define RASTER_MAX_RADIUS 8191
+
+typedef struct {
+    int x, y;
+} point_t;
+
+void fill_circle(int cx, int cy, int radius, uint8_t r, uint8_t g, uint8_t b);
+
+// axis-aligned, rx and ry are the half widths
+void ellipse(int cx, int cy, int rx, int ry, uint8_t r, uint8_t g, uint8_t b);
+void fill_ellipse(int cx, int cy, int rx, int ry, uint8_t r, uint8_t g, uint8_t b);
+
+// closed outline through the n points, edges drawn like line()
+void polygon(const point_t *pts, int n, uint8_t r, uint8_t g, uint8_t b, int width);
+
+// vertices are pixel corners and a pixel is in if its centre is (nonzero
+// winding), so concave and self-intersecting polygons work and shapes that
+// share an edge do not overlap
+void fill_polygon(const point_t *pts, int n, uint8_t r, uint8_t g, uint8_t b);
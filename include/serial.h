@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// 16550 UART on COM1 (char/serial.c), 115200 8N1 with FIFOs. Output goes
+// through a transmit ring drained by IRQ4, so writers only block when the
+// ring is full.
+
+#define COM1_BASE       0x3F8
+#define COM1_IRQ        4
+#define SERIAL_BAUD     115200
+#define SERIAL_TX_RING  4096    // bytes, power of two
+
+// probe COM1 and register it as the "com1" console sink, 0 if there is no UART
+int serial_init(void);
+
+// queue bytes ('\n' goes out as "\r\n")
+void serial_write(const char* s, size_t n);
+
+// push out everything queued by polling, for panics with interrupts off
+void serial_sync(void);
+
+// IRQ4 body, called from the stub in idt.c with interrupts off
+void serial_irq(void);
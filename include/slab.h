@@ -0,0 +1,21 @@
+#pragma once
+#include <stddef.h>
+
+// Slab object caches for fixed-size kernel objects (mm/slab.c).
+// Objects come out of page sized slabs carved from the heap, no per-object
+// header, alloc/free is a pop/push on the slab's free list.
+
+typedef struct kmem_cache kmem_cache_t;
+
+// ctor (optional) runs once per object when its slab is created, objects
+// must be handed back to kmem_cache_free() in their constructed state
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align,
+                                void (*ctor)(void* obj));
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+// every object of the cache must have been freed
+void kmem_cache_destroy(kmem_cache_t* cache);
+
+// print usage counters of every cache (slabinfo command)
+void kmem_cache_info(void);
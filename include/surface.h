@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vesa.h>
+
+// Surfaces (modules/video/surface.c): a block of pixels in one of the
+// fb_ops formats. The screen is one too, drawing into it goes to the shadow
+// framebuffer and is flushed like everything else. Every operation clips
+// against both surfaces, so any coordinates are fine.
+
+typedef struct {
+    uint8_t *pixels;
+    size_t pitch;               // bytes from one row to the next
+    int width, height;
+    const fb_ops_t *format;
+} surface_t;
+
+// the framebuffer as a surface (the pointer stays valid, the contents follow the mode)
+surface_t *surface_screen(void);
+
+// w x h pixels, uninitialised; NULL when out of memory
+surface_t *surface_create(int w, int h, const fb_ops_t *format);
+void surface_destroy(surface_t *s);
+
+// copy the w x h pixels at (sx, sy) of src to (dx, dy) of dst. src has to be
+// in dst's format, or be 32 bit xrgb/argb (converted pixel by pixel)
+void surface_blit(surface_t *dst, int dx, int dy, const surface_t *src, int sx, int sy, int w, int h);
+
+// the same, leaving out the src pixels equal to key (native, in src's format)
+void surface_blit_key(surface_t *dst, int dx, int dy, const surface_t *src, int sx, int sy,
+                      int w, int h, uint32_t key);
+
+// src in argb8888 blended over dst by its alpha. xrgb8888 and argb8888
+// destinations get real blending, others only the pixels with alpha >= 128
+void surface_blend(surface_t *dst, int dx, int dy, const surface_t *src, int sx, int sy, int w, int h);
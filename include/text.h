@@ -2,12 +2,18 @@
 #define TEXT_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 
 /* Character dimensions */
 #define CHAR_WIDTH 8
 #define CHAR_HEIGHT 16
 
+/* Lines of scrollback kept, compile-time configurable (4 bytes per cell) */
+#ifndef SCROLLBACK_LINES
+#define SCROLLBACK_LINES 2000
+#endif
+
 /* Cursor position */
 extern int cursor_x;
 extern int cursor_y;
@@ -15,12 +21,17 @@ extern int cursor_y;
 /* Public API */
 void update_max(void);
 void draw_char_cell(int cx, int cy, short unsigned int c);
+/* print() and printf() take VT100/ANSI escapes, see the list in text.c */
 void print(const char *s);
+void print_n(const char *s, size_t n);
 void clear_screen_text(void);
+/* page the view through scrollback, > 0 back, < 0 forward; output returns to the live screen */
+void scrollback_page(int pages);
 void set_text_color(uint8_t fr, uint8_t fg, uint8_t fb,
                     uint8_t br, uint8_t bg, uint8_t bb);
 
 void text_init(void);
 void init_font();
+void set_glyph(uint32_t glyph_index, const uint8_t glyph[16]);
 
 #endif /* TEXT_H */
@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include <stddef.h>
 
 typedef struct __attribute__((packed)) mode_info {
     uint16_t ModeAttributes;
@@ -34,17 +35,83 @@ typedef struct __attribute__((packed)) mode_info {
     uint32_t PhysBasePtr;
     uint32_t OffScreenMemOffset;
     uint16_t OffScreenMemSize;
-} mode_info_t;
+    // VBE 3.0
+    uint16_t LinBytesPerScanLine;
+    uint8_t  BnkNumberOfImagePages;
+    uint8_t  LinNumberOfImagePages;
+    uint8_t  LinRedMaskSize;
+    uint8_t  LinRedFieldPosition;
+    uint8_t  LinGreenMaskSize;
+    uint8_t  LinGreenFieldPosition;
+    uint8_t  LinBlueMaskSize;
+    uint8_t  LinBlueFieldPosition;
+    uint8_t  LinRsvdMaskSize;
+    uint8_t  LinRsvdFieldPosition;
+    uint32_t MaxPixelClock;
+    uint8_t  Reserved[190];
+} mode_info_t;                          // the whole 256 byte block, entry.s copies all of it
 
 // Basic drawing functions
 void set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
 void rectangle(int x, int y, int w, int h, uint8_t r, uint8_t g, uint8_t b);
-void line(int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b, int width);
+void line(int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b, int width);    // raster.c
 void clear_screen(uint8_t r, uint8_t g, uint8_t b);
 
+// Shadow framebuffer: once fb_shadow_init() has run, drawing goes to a RAM
+// copy of the screen and fb_flush() (explicit, or from the timer interrupt)
+// copies the damaged parts to video memory
+void fb_shadow_init(void);
+uint8_t* fb_target(void);                   // where to draw: shadow or VRAM
+void fb_damage(int x, int y, int w, int h); // after drawing straight into fb_target()
+void fb_flush(void);
+// With a shadow on Bochs/QEMU std-vga, spread video memory over several
+// screens' worth of rows (dispi.h): fb_flush() then draws into a hidden page
+// and flips to it, and whole-screen scrolls move the scanout instead of the
+// pixels. Returns the rows of video memory in use, 0 when it stays off
+// (also when the BIOS did not report the size of video memory).
+int fb_pages_init(void);
+
+// pixel value for r, g, b in the current mode's format (low bytes for 16/24 bit)
+uint32_t vesa_color(uint8_t r, uint8_t g, uint8_t b);
+
+// Drawing ops for one pixel format (pixfmt.c). vesa_init() picks the table
+// for vesa_mode_info once the mode is set; every drawing layer goes through
+// fb_ops and leaves the format to it. Colours are native pixel values.
+typedef uint8_t fb_glyph_row_t[32];     // one 8 pixel glyph row, up to 4 bytes a pixel
+
+typedef struct {
+    const char *name;
+    unsigned int bytes;                 // per pixel, 0 when nothing can be drawn
+    uint32_t (*color)(uint8_t r, uint8_t g, uint8_t b);
+    void (*pixel)(uint8_t *dst, uint32_t color);
+    void (*span)(uint8_t *dst, uint32_t color, size_t n);
+    // w x h pixels in this format from src to dst
+    void (*blit)(uint8_t *dst, size_t dst_pitch, const uint8_t *src, size_t src_pitch, int w, int h);
+    // rows[bits] = the 8 pixels of glyph row bits in fg and bg
+    void (*glyph_rows)(fb_glyph_row_t *rows, uint32_t fg, uint32_t bg);
+    // one 8x16 glyph, bitmap[row] indexes rows
+    void (*glyph)(uint8_t *dst, size_t pitch, const uint8_t *bitmap, fb_glyph_row_t *rows);
+} fb_ops_t;
+
+extern const fb_ops_t *fb_ops;
+void vesa_init(void);
+
+// the formats with a fixed layout, also usable for off-screen surfaces;
+// argb8888 keeps straight alpha in the top byte
+extern const fb_ops_t fb_xrgb8888, fb_argb8888, fb_rgb888, fb_rgb565, fb_rgb555;
+
+// move count scanlines from src_y to dst_y (may overlap), for scrolling
+void vesa_move_rows(int dst_y, int src_y, int count);
+
+// fill [x0, x1) of row y with a native colour, clipped to the screen; the
+// caller reports the damage (raster.c does once per shape)
+void fb_span(int y, int x0, int x1, uint32_t color);
+
 // Optional helpers
 void draw_hline(int x, int y, int w, uint8_t r, uint8_t g, uint8_t b);
 void draw_vline(int x, int y, int h, uint8_t r, uint8_t g, uint8_t b);
-void circle(int cx, int cy, int radius, uint8_t r, uint8_t g, uint8_t b);
+void circle(int cx, int cy, int radius, uint8_t r, uint8_t g, uint8_t b);                 // raster.c
 
-extern mode_info_t vesa_mode_info;
\ No newline at end of file
+extern mode_info_t vesa_mode_info;
+extern uint16_t vesa_mode_number;       // the VBE mode entry.s picked and set
+extern uint32_t vesa_vram_bytes;        // video memory the BIOS reports, 0 if it did not
\ No newline at end of file
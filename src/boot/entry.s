@@ -1,6 +1,8 @@
 [bits 16]
 global entry_start
 extern vesa_mode_info
+extern vesa_mode_number
+extern vesa_vram_bytes
 extern font
 extern base_font
 
@@ -8,12 +10,80 @@ entry_start:
 
 times 16 nop
 
-mov bx, 0x411B
+; VBE: walk the BIOS mode list for the biggest linear 32 bpp mode that fits
+; in VBE_MAX_X x VBE_MAX_Y (makefile), falling back to the old fixed mode
+MODE_INFO   equ 0x8000          ; 256 byte mode info of the mode that gets set
+VBE_MODE    equ 0x8100          ; its number
+VBE_MEMORY  equ 0x8102          ; video memory in 64 KiB blocks, 0 if unknown
+VBE_BEST    equ 0x8104          ; pixels of the best mode so far
+VBE_INFO    equ 0x8200          ; 512 byte controller info
+VBE_FALLBACK equ 0x011B
+
+%ifndef VBE_MAX_X
+%define VBE_MAX_X 1280
+%endif
+%ifndef VBE_MAX_Y
+%define VBE_MAX_Y 1024
+%endif
+
+mov word [VBE_MODE], VBE_FALLBACK
+mov word [VBE_MEMORY], 0
+mov dword [VBE_BEST], 0
+mov dword [VBE_INFO], 'VBE2'    ; ask for the VBE 2.0 fields
+mov ax, 0x4F00
+mov di, VBE_INFO
+int 10h
+cmp ax, 0x004F
+jne .vbe_set
+cmp dword [VBE_INFO], 'VESA'
+jne .vbe_set
+mov ax, [VBE_INFO + 18]         ; TotalMemory
+mov [VBE_MEMORY], ax
+lfs si, [VBE_INFO + 14]         ; VideoModePtr, 0xFFFF terminated
+.vbe_next:
+mov cx, [fs:si]
+add si, 2
+cmp cx, 0xFFFF
+je .vbe_set
+push fs
+push si
+push cx
 mov ax, 0x4F01
-mov di, 0x8000
-mov cx, bx
+mov di, MODE_INFO
 int 10h
-
+pop cx
+pop si
+pop fs
+cmp ax, 0x004F
+jne .vbe_next
+mov ax, [MODE_INFO]             ; ModeAttributes: supported, graphics, linear
+and ax, 0x0091
+cmp ax, 0x0091
+jne .vbe_next
+cmp byte [MODE_INFO + 25], 32   ; BitsPerPixel
+jne .vbe_next
+cmp byte [MODE_INFO + 27], 6    ; MemoryModel: direct colour
+jne .vbe_next
+movzx eax, word [MODE_INFO + 18]
+cmp eax, VBE_MAX_X
+ja .vbe_next
+movzx ebx, word [MODE_INFO + 20]
+cmp ebx, VBE_MAX_Y
+ja .vbe_next
+imul eax, ebx
+cmp eax, [VBE_BEST]
+jbe .vbe_next
+mov [VBE_BEST], eax
+mov [VBE_MODE], cx
+jmp .vbe_next
+
+.vbe_set:
+mov cx, [VBE_MODE]
+mov ax, 0x4F01
+mov di, MODE_INFO
+int 10h
+mov bx, [VBE_MODE]
+or bx, 0x4000                   ; linear framebuffer
 mov ax, 0x4F02
 int 10h
 
@@ -31,6 +101,42 @@ mov	    cx, 256*16/4
 rep     movsd
 pop	    ds
 
+; BIOS E820 memory map -> E820_MAP, entry count -> E820_COUNT (see pmm.h)
+E820_COUNT  equ 0x500
+E820_MAP    equ 0x504
+E820_MAX    equ 128
+
+mov di, E820_MAP
+xor ebx, ebx
+xor bp, bp
+.e820_next:
+mov eax, 0xE820
+mov edx, 0x534D4150         ; 'SMAP'
+mov ecx, 24
+mov dword [es:di + 20], 1   ; ACPI 3.0 attributes, "valid" unless the BIOS fills them in
+int 15h
+jc .e820_done               ; no E820 at all, or past the last entry
+cmp eax, 0x534D4150
+jne .e820_done
+cmp cl, 20
+jbe .e820_check
+test byte [es:di + 20], 1   ; ACPI 3.0 says ignore this one
+jz .e820_skip
+.e820_check:
+mov ecx, [es:di + 8]
+or ecx, [es:di + 12]
+jz .e820_skip               ; zero length
+inc bp
+add di, 24
+cmp bp, E820_MAX
+jae .e820_done
+.e820_skip:
+test ebx, ebx
+jnz .e820_next
+.e820_done:
+mov word [E820_COUNT], bp
+mov word [E820_COUNT + 2], 0
+
 lgdt [gdt_descriptor]
 
 mov eax, cr0
@@ -66,12 +172,19 @@ pm_start:
     mov ss, ax
     mov esp, 0x8FFF    ; setup stack somewhere unsafe (the whole code is loaded at 0x9000 btw)
 
-    mov ecx, 50
-.loop:
-    mov al, [0x8000+ecx]
-    mov [vesa_mode_info+ecx], al
-    loop .loop
-
+    cld
+    mov esi, MODE_INFO
+    mov edi, vesa_mode_info
+    mov ecx, 256 / 4
+    rep movsd
+    mov ax, [VBE_MODE]
+    mov [vesa_mode_number], ax
+    movzx eax, word [VBE_MEMORY]
+    shl eax, 16
+    mov [vesa_vram_bytes], eax
+
+    push dword [E820_COUNT]
+    push dword E820_MAP
     call main
 
 global load_idt
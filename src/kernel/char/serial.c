@@ -0,0 +1,122 @@
+// char/serial.c -- 16550 UART console on COM1
+//
+// Writers copy into a transmit ring and return; the UART's "transmitter
+// holding register empty" interrupt moves up to a FIFO's worth (16 bytes)
+// at a time from the ring to the chip. The interrupt is only enabled while
+// the ring has data. When the ring is full the writer falls back to
+// polling the line status, so output is never dropped, even with
+// interrupts off or before the IDT is up.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <asm.h>
+#include <serial.h>
+#include <console.h>
+
+#define UART_THR    0       /* transmit holding (write) */
+#define UART_RBR    0       /* receive buffer (read) */
+#define UART_DLL    0       /* divisor low, with LCR_DLAB */
+#define UART_IER    1
+#define UART_DLM    1       /* divisor high, with LCR_DLAB */
+#define UART_IIR    2       /* interrupt identification (read) */
+#define UART_FCR    2       /* FIFO control (write) */
+#define UART_LCR    3
+#define UART_MCR    4
+#define UART_LSR    5
+
+#define IER_THRI    0x02
+#define FCR_ENABLE  0x01
+#define FCR_CLEAR   0x06    /* clear both FIFOs */
+#define FCR_TRIG14  0xC0
+#define LCR_8N1     0x03
+#define LCR_DLAB    0x80
+#define MCR_DTR     0x01
+#define MCR_RTS     0x02
+#define MCR_OUT2    0x08    /* gates the IRQ line on PCs */
+#define MCR_LOOP    0x10
+#define LSR_DR      0x01    /* data ready */
+#define LSR_THRE    0x20
+
+#define UART_FIFO   16
+#define UART_CLOCK  115200
+
+static char tx_ring[SERIAL_TX_RING];
+static volatile uint32_t tx_head = 0;   /* next byte written, by serial_write */
+static volatile uint32_t tx_tail = 0;   /* next byte sent, by the interrupt */
+static int present = 0;
+
+static console_sink_t com1_sink = { "com1", serial_write, LOG_DEBUG, NULL };
+
+static inline uint8_t uart_in(int reg) { return inb(COM1_BASE + reg); }
+static inline void uart_out(int reg, uint8_t v) { outb(COM1_BASE + reg, v); }
+
+/* move up to a FIFO's worth from the ring to the UART if it is idle, and
+   keep the interrupt enabled exactly while there is more (also while the
+   UART is still busy, that interrupt is what picks the rest up later).
+   Interrupts off */
+static void tx_fill(void) {
+    if (uart_in(UART_LSR) & LSR_THRE) {
+        for (int i = 0; i < UART_FIFO && tx_tail != tx_head; ++i) {
+            uart_out(UART_THR, (uint8_t)tx_ring[tx_tail & (SERIAL_TX_RING - 1)]);
+            tx_tail++;
+        }
+    }
+    uart_out(UART_IER, tx_tail != tx_head ? IER_THRI : 0);
+}
+
+/* ring full: wait for the UART by hand instead of for the interrupt */
+static void tx_make_room(void) {
+    while (!(uart_in(UART_LSR) & LSR_THRE)) cpu_relax();
+    tx_fill();
+}
+
+void serial_write(const char* s, size_t n) {
+    if (!present) return;
+
+    uintptr_t flags = irq_save();
+    for (size_t i = 0; i < n; ++i) {
+        /* the host terminal is raw, it wants the carriage return */
+        if (s[i] == '\n') {
+            while (SERIAL_TX_RING - (tx_head - tx_tail) < 2) tx_make_room();
+            tx_ring[tx_head++ & (SERIAL_TX_RING - 1)] = '\r';
+        } else {
+            while (tx_head - tx_tail == SERIAL_TX_RING) tx_make_room();
+        }
+        tx_ring[tx_head++ & (SERIAL_TX_RING - 1)] = s[i];
+    }
+    tx_fill();
+    irq_restore(flags);
+}
+
+void serial_sync(void) {
+    if (!present) return;
+    uintptr_t flags = irq_save();
+    while (tx_tail != tx_head) tx_make_room();
+    while (!(uart_in(UART_LSR) & LSR_THRE)) cpu_relax();
+    irq_restore(flags);
+}
+
+void serial_irq(void) {
+    (void)uart_in(UART_IIR);    /* acknowledges a THRE interrupt */
+    tx_fill();
+}
+
+int serial_init(void) {
+    uart_out(UART_IER, 0);
+    uart_out(UART_LCR, LCR_DLAB);
+    uart_out(UART_DLL, (uint8_t)(UART_CLOCK / SERIAL_BAUD));
+    uart_out(UART_DLM, (uint8_t)((UART_CLOCK / SERIAL_BAUD) >> 8));
+    uart_out(UART_LCR, LCR_8N1);
+    uart_out(UART_FCR, FCR_ENABLE | FCR_CLEAR | FCR_TRIG14);
+
+    /* loopback: a byte sent has to come back, or there is no UART here */
+    uart_out(UART_MCR, MCR_LOOP | MCR_RTS | MCR_OUT2);
+    uart_out(UART_THR, 0xAE);
+    for (int i = 0; i < 1000 && !(uart_in(UART_LSR) & LSR_DR); ++i) cpu_relax();
+    if (uart_in(UART_RBR) != 0xAE) return 0;
+
+    uart_out(UART_MCR, MCR_DTR | MCR_RTS | MCR_OUT2);
+    present = 1;
+    console_register(&com1_sink);
+    return 1;
+}
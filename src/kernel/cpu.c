@@ -0,0 +1,129 @@
+// cpu.c -- CPUID feature detection and boot time patching of alternatives
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <asm.h>
+#include <cpu.h>
+#include <cyrillic.h>
+
+#define CR0_MP          0x2u
+#define CR0_EM          0x4u
+#define CR4_OSFXSR      0x200u
+#define CR4_OSXMMEXCPT  0x400u
+
+cpu_features_t cpu_features;
+uint8_t irq_fxsave = 0;
+
+/* linker.ld (or the host linker) brackets the altinstr section with these */
+extern const alt_instr_t __start_altinstr[];
+extern const alt_instr_t __stop_altinstr[];
+
+void cpu_detect(void) {
+    uint32_t a, b, c, d;
+    cpu_features_t* f = &cpu_features;
+    memset(f, 0, sizeof(*f));
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    f->max_leaf = a;
+    memcpy(f->vendor, &b, 4);
+    memcpy(f->vendor + 4, &d, 4);
+    memcpy(f->vendor + 8, &c, 4);
+
+    if (f->max_leaf >= 1) {
+        cpuid(1, 0, &a, &b, &c, &d);
+        f->words[0] = d;
+        f->words[1] = c;
+        f->stepping = a & 0xF;
+        f->model = (a >> 4) & 0xF;
+        f->family = (a >> 8) & 0xF;
+        if (f->family == 0xF) f->family += (a >> 20) & 0xFF;
+        if (f->family >= 6) f->model |= ((a >> 16) & 0xF) << 4;
+    }
+    if (f->max_leaf >= 7) {
+        cpuid(7, 0, &a, &b, &c, &d);
+        f->words[2] = b;
+        f->words[3] = d;
+    }
+
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    f->max_ext_leaf = a;
+    if (f->max_ext_leaf >= 0x80000001) {
+        cpuid(0x80000001, 0, &a, &b, &c, &d);
+        f->words[4] = d;
+    }
+    if (f->max_ext_leaf >= 0x80000004) {
+        uint32_t* p = (uint32_t*)f->brand;
+        for (uint32_t leaf = 0x80000002; leaf <= 0x80000004; leaf++, p += 4)
+            cpuid(leaf, 0, &p[0], &p[1], &p[2], &p[3]);
+    }
+
+    /* nothing saves AVX state (no XSAVE support), so no AVX code may run */
+    f->words[CPU_AVX / 32] &= ~(1u << (CPU_AVX % 32));
+    f->words[CPU_AVX2 / 32] &= ~(1u << (CPU_AVX2 % 32));
+    /* SSE code needs FXSR to be usable at all */
+    if (!cpu_has(CPU_FXSR))
+        f->words[0] &= ~((1u << (CPU_SSE % 32)) | (1u << (CPU_SSE2 % 32)));
+}
+
+static void enable_sse(void) {
+    if (!cpu_has(CPU_SSE)) return;
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    irq_fxsave = 1;
+}
+
+/* records for one site are listed in order of preference, last match wins */
+void alternatives_apply(void) {
+    for (const alt_instr_t* alt = __start_altinstr; alt < __stop_altinstr; alt++) {
+        if (!cpu_has((unsigned int)alt->feature)) continue;
+        uint8_t* site = (uint8_t*)alt->site;
+        int32_t rel = (int32_t)(alt->target - (alt->site + 5));
+        memcpy(site + 1, &rel, sizeof(rel));
+    }
+    /* serializing, drops anything prefetched from the old jumps */
+    uint32_t a, b, c, d;
+    cpuid(0, 0, &a, &b, &c, &d);
+}
+
+void cpu_init(void) {
+    cpu_detect();
+    enable_sse();
+    alternatives_apply();
+}
+
+static const struct {
+    unsigned int feature;
+    const char* name;
+} feature_names[] = {
+    { CPU_FPU, "fpu" },     { CPU_PSE, "pse" },     { CPU_TSC, "tsc" },
+    { CPU_MSR, "msr" },     { CPU_PAE, "pae" },     { CPU_APIC, "apic" },
+    { CPU_MTRR, "mtrr" },   { CPU_PGE, "pge" },     { CPU_CMOV, "cmov" },
+    { CPU_PAT, "pat" },     { CPU_CLFLUSH, "clflush" }, { CPU_MMX, "mmx" },
+    { CPU_FXSR, "fxsr" },   { CPU_SSE, "sse" },     { CPU_SSE2, "sse2" },
+    { CPU_SSE3, "sse3" },   { CPU_SSSE3, "ssse3" }, { CPU_SSE41, "sse4.1" },
+    { CPU_SSE42, "sse4.2" }, { CPU_POPCNT, "popcnt" }, { CPU_XSAVE, "xsave" },
+    { CPU_BMI1, "bmi1" },   { CPU_BMI2, "bmi2" },   { CPU_ERMS, "erms" },
+    { CPU_FSRM, "fsrm" },   { CPU_NX, "nx" },       { CPU_LM, "lm" },
+};
+
+void cpu_info(void) {
+    const cpu_features_t* f = &cpu_features;
+    const char* brand = f->brand;
+    while (*brand == ' ') brand++;
+
+    printf("CPU: %s %s\n", f->vendor, *brand ? brand : "(no brand string)");
+    printf("Family %u, model %u, stepping %u, max leaf 0x%X / 0x%X\n",
+           f->family, f->model, f->stepping, f->max_leaf, f->max_ext_leaf);
+    printf("Features:");
+    for (size_t i = 0; i < sizeof(feature_names) / sizeof(feature_names[0]); i++)
+        if (cpu_has(feature_names[i].feature)) printf(" %s", feature_names[i].name);
+    printf("\n");
+
+    unsigned int patched = 0;
+    for (const alt_instr_t* alt = __start_altinstr; alt < __stop_altinstr; alt++)
+        if (cpu_has((unsigned int)alt->feature)) patched++;
+    printf("Alternatives: %u records, %u match this CPU\n",
+           (unsigned int)(__stop_altinstr - __start_altinstr), patched);
+}
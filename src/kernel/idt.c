@@ -1,9 +1,12 @@
 #include <idt.h>
+#include <cpu.h>
 #include <stdio.h>   // for printf, can be replaced with your kernel print
 #include <cyrillic.h>   // for printf, can be replaced with your kernel print
 #include <asm.h>     // for outb
 #include <vesa.h>     // for outb
 #include <text.h>     // for outb
+#include <serial.h>
+#include <klog.h>
 
 
 static void print_registers_state(void) {
@@ -51,6 +54,9 @@ void base_exception(const char* msg) {
     clear_screen_text();
     printf("Exception Catched: %s Error/Exception\n", msg);
     print_registers_state();
+    klog_drain();
+    fb_flush();
+    serial_sync();
     for (;;) {asm volatile ("hlt");}
 }
 
@@ -74,6 +80,9 @@ static void exception0()  { // #DIV, reboot exception 2
     clear_screen_text();
     printf("Exception Catched: Invalid Opcode Error/Exception\n");
     print_registers_state();
+    klog_drain();
+    fb_flush();
+    serial_sync();
     for (;;) {asm volatile ("hlt");}
 }
 static void exception1()  { base_exception("Debug"); }
@@ -93,6 +102,9 @@ static void exception6()  { // #OP, reboot exception # 1
     clear_screen_text();
     printf("Exception Catched: Invalid Opcode Error/Exception\n");
     print_registers_state();
+    klog_drain();
+    fb_flush();
+    serial_sync();
     for (;;) {asm volatile ("hlt");}
 }
 static void exception7()  { base_exception("Device Not Available"); }
@@ -149,15 +161,74 @@ extern void irq0();
 extern void irq1();
 
 int timer_reached_end = 0;
+volatile uint32_t timer_ticks = 0;
 
 // -----------------------------
 // IRQ0 (PIT)
 // -----------------------------
+void pit_init(uint32_t hz) {
+    uint32_t divisor = PIT_BASE_HZ / hz;
+    if (divisor > 0xFFFF) divisor = 0xFFFF;
+    outb(PIT_COMMAND, 0x36);                    // channel 0, lo/hi byte, square wave
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+}
+
+// Around the C handler: the FPU/SSE state of whatever was interrupted goes
+// into 512 bytes of stack (FXSAVE wants them 16 byte aligned) and comes back
+// before iret. %ebp holds the old %esp; pusha saved the caller's.
+#define IRQ_FXSAVE                  \
+    "movl %%esp, %%ebp\n\t"         \
+    "cmpb $0, irq_fxsave\n\t"       \
+    "je 8f\n\t"                     \
+    "subl $512, %%esp\n\t"          \
+    "andl $-16, %%esp\n\t"          \
+    "fxsave (%%esp)\n\t"            \
+    "8:\n\t"
+
+#define IRQ_FXRSTOR                 \
+    "cmpb $0, irq_fxsave\n\t"       \
+    "je 9f\n\t"                     \
+    "fxrstor (%%esp)\n\t"           \
+    "9:\n\t"                        \
+    "movl %%ebp, %%esp\n\t"
+
+// called from irq0 with interrupts off
+void timer_tick(void) {
+    timer_ticks++;
+    fb_flush();
+}
+
 __attribute__((naked)) void irq0(void)
 {
     asm volatile(
         "pusha\n\t"
+        "cld\n\t"
+        IRQ_FXSAVE
         "movl $1, timer_reached_end\n\t"
+        "call timer_tick\n\t"
+        IRQ_FXRSTOR
+        "movb $0x20, %%al\n\t"
+        "outb %%al, $0x20\n\t"
+        "popa\n\t"
+        "iret\n\t"
+        :
+        :
+        : "al", "memory"
+    );
+}
+
+// -----------------------------
+// IRQ4 (COM1)
+// -----------------------------
+__attribute__((naked)) void irq4(void)
+{
+    asm volatile(
+        "pusha\n\t"
+        "cld\n\t"
+        IRQ_FXSAVE
+        "call serial_irq\n\t"
+        IRQ_FXRSTOR
         "movb $0x20, %%al\n\t"
         "outb %%al, $0x20\n\t"
         "popa\n\t"
@@ -258,7 +329,7 @@ void init_idt(idt_entry_t* idt) {
     set_idt_entry(idt, 33, (uint32_t)irq1, 0x08, 0x8E);
     set_idt_entry(idt, 34, (uint32_t)isr_stub, 0x08, 0x8E);
     set_idt_entry(idt, 35, (uint32_t)isr_stub, 0x08, 0x8E);
-    set_idt_entry(idt, 36, (uint32_t)isr_stub, 0x08, 0x8E);
+    set_idt_entry(idt, 32 + COM1_IRQ, (uint32_t)irq4, 0x08, 0x8E);
     set_idt_entry(idt, 37, (uint32_t)isr_stub, 0x08, 0x8E);
     set_idt_entry(idt, 38, (uint32_t)isr_stub, 0x08, 0x8E);
     set_idt_entry(idt, 39, (uint32_t)isr_stub, 0x08, 0x8E);
@@ -274,5 +345,6 @@ void init_idt(idt_entry_t* idt) {
     idt_ptr.base = (uint32_t)idt;
     idt_ptr.limit = (256*sizeof(idt_entry_t))-1;
     load_idt(&idt_ptr);
+    pit_init(PIT_HZ);
     asm volatile("sti");
 }
\ No newline at end of file
@@ -0,0 +1,136 @@
+// klog.c -- kernel log ring
+//
+// Record n lives in slot n % (ring size). Until klog_init() runs the ring is
+// a few static slots, then KLOG_RECORDS from the heap. A writer takes n with one atomic
+// fetch-and-add on klog_head, clears the slot's seq, fills the slot and
+// publishes it by storing n + 1 into seq. No lock, so an interrupt handler
+// can log in the middle of someone else's record; it just gets the next
+// slot. Readers copy a slot and keep it only if seq read n + 1 both before
+// and after the copy, anything else means it was being (over)written.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <klog.h>
+#include <console.h>
+#include <idt.h>
+#include <asm.h>
+
+static klog_record_t early[KLOG_EARLY_RECORDS];
+static klog_record_t* ring = early;
+static uint32_t ring_mask = KLOG_EARLY_RECORDS - 1;
+static uint32_t klog_head = 0;          /* next sequence number handed out */
+static uint32_t drained = 0;            /* first record klog_drain() has not printed */
+static int drain_on = 1;
+
+void klog_init(void) {
+    if (ring != early) return;
+    klog_record_t* big = malloc(KLOG_RECORDS * sizeof(klog_record_t));
+    if (!big) return;   /* keep logging into the early slots */
+    memset(big, 0, KLOG_RECORDS * sizeof(klog_record_t));
+
+    /* what boot logged so far moves over under its sequence numbers */
+    uintptr_t flags = irq_save();
+    uint32_t head = klog_head;
+    uint32_t n = head > KLOG_EARLY_RECORDS ? head - KLOG_EARLY_RECORDS : 0;
+    for (; n != head; n++)
+        big[n & (KLOG_RECORDS - 1)] = early[n & (KLOG_EARLY_RECORDS - 1)];
+    ring = big;
+    ring_mask = KLOG_RECORDS - 1;
+    irq_restore(flags);
+}
+
+void vklog(int level, const char* fmt, va_list ap) {
+    uint32_t n = __atomic_fetch_add(&klog_head, 1, __ATOMIC_RELAXED);
+    klog_record_t* r = &ring[n & ring_mask];
+
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    r->ticks = timer_ticks;
+    r->level = (uint8_t)level;
+
+    int len = vsnprintf(r->text, sizeof(r->text), fmt, ap);
+    if (len >= (int)sizeof(r->text)) len = sizeof(r->text) - 1;
+    if (len > 0 && r->text[len - 1] == '\n') r->text[--len] = '\0';
+
+    /* "[tag] text" or "[tag]: text" becomes the tag */
+    r->tag[0] = '\0';
+    if (r->text[0] == '[') {
+        size_t tlen = 0;
+        while (tlen < KLOG_TAG_LEN - 1 && r->text[1 + tlen] && r->text[1 + tlen] != ']') tlen++;
+        if (r->text[1 + tlen] == ']') {
+            const char* end = r->text + 2 + tlen;
+            memcpy(r->tag, r->text + 1, tlen);
+            r->tag[tlen] = '\0';
+            if (*end == ':') end++;
+            while (*end == ' ') end++;
+            memmove(r->text, end, strlen(end) + 1);
+        }
+    }
+
+    __atomic_store_n(&r->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+void klog(int level, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vklog(level, fmt, ap);
+    va_end(ap);
+}
+
+/* copy record n out, 0 if it is gone or not finished */
+static int klog_read(uint32_t n, klog_record_t* out) {
+    const klog_record_t* r = &ring[n & ring_mask];
+    if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != n + 1) return 0;
+    memcpy(out, r, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&r->seq, __ATOMIC_RELAXED) == n + 1;
+}
+
+static void klog_print(const klog_record_t* r, int level) {
+    printk(level, "[%5u.%02u] %s%s%s\n", r->ticks / PIT_HZ, (r->ticks % PIT_HZ) * 100 / PIT_HZ,
+           r->tag, r->tag[0] ? ": " : "", r->text);
+}
+
+void klog_drain(void) {
+    static int busy = 0;
+    if (!drain_on || busy) return;
+
+    uint32_t head = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+    if (drained == head) return;
+    busy = 1;       /* printing may log, which must not recurse in here */
+
+    uint32_t n = drained;
+    if (head - n > ring_mask + 1) {
+        printk(LOG_WARN, "[klog] %u records lost\n", head - n - (ring_mask + 1));
+        n = head - (ring_mask + 1);
+    }
+    klog_record_t r;
+    for (; n != head; n++) {
+        /* an unfinished record stops the drain, it gets printed next time */
+        if (!klog_read(n, &r)) {
+            uint32_t seq = __atomic_load_n(&ring[n & ring_mask].seq, __ATOMIC_RELAXED);
+            if (seq == 0) break;
+            continue;
+        }
+        klog_print(&r, r.level);
+    }
+    drained = n;
+    busy = 0;
+}
+
+void klog_set_drain(int on) {
+    drain_on = on;
+}
+
+void klog_dump(void) {
+    uint32_t head = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+    uint32_t n = head > ring_mask + 1 ? head - (ring_mask + 1) : 0;
+    klog_record_t r;
+    for (; n != head; n++) {
+        if (klog_read(n, &r)) klog_print(&r, LOG_ERR);
+    }
+}
@@ -1,86 +1,532 @@
+// libc/malloc.c -- TLSF (two-level segregated fit) kernel heap
+//
+// Free blocks live in FL_COUNT x SL_COUNT segregated lists: the first level
+// splits sizes by power of two, the second level splits each power of two in
+// SL_COUNT linear steps. Two bitmaps say which lists are non-empty, so finding
+// a fitting block is a couple of bit scans instead of a list walk.
+// Every block keeps a pointer to its physical predecessor (boundary tag), so
+// free() merges with both neighbours in constant time.
+// The heap starts out as the small linker reserved boot heap and grows by
+// whole buddy blocks from the page allocator whenever a request does not fit.
+// With HEAP_STATS the heap keeps a few counters (heap_print_stats, the heapstat
+// command), with HEAP_TRACK_CALLERS every block also remembers who allocated it.
+
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <heap.h>
+#include <pmm.h>
 #include <cyrillic.h>
 
 
 extern char _heap_start;
 extern char _heap_end;
 
+#define SL_LOG2     4
+#define SL_COUNT    (1u << SL_LOG2)
+#define FL_SHIFT    (SL_LOG2 + MALLOC_ALIGN_LOG2)
+#define SMALL_BLOCK (1u << FL_SHIFT)      /* below this, fl 0 is split linearly */
+#define FL_MAX      30                    /* largest block: 2^31 - 1 bytes */
+#define FL_COUNT    (FL_MAX - FL_SHIFT + 2)
+#define HEAP_GROW_MIN 0x100000u           /* take at least 1 MiB per growth */
+
+#define ALIGN_UP(x, a)   (((x) + ((a) - 1)) & ~((size_t)(a) - 1))
+#define ALIGN_DOWN(x, a) ((x) & ~((size_t)(a) - 1))
+
 typedef struct block {
-    size_t size;
-    struct block* next;
+    struct block* prev_phys;    /* boundary tag, NULL for the first block of a pool */
+    size_t size;                /* payload bytes | BLOCK_FREE */
+#if HEAP_TRACK_CALLERS
+    void* caller;               /* return address of the allocating call */
+#endif
+    /* only valid while the block is free, overlaid on the payload */
+    struct block* next_free;
+    struct block* prev_free;
 } block_t;
 
-static block_t* free_list = (block_t*)&_heap_start;
+#define BLOCK_FREE  ((size_t)1)
+#define HDR_SIZE    ALIGN_UP(offsetof(block_t, next_free), MALLOC_ALIGN)
+#define BLOCK_MIN   ALIGN_UP(sizeof(block_t) - offsetof(block_t, next_free), MALLOC_ALIGN)
+#define BLOCK_MAX   (((size_t)1 << (FL_MAX + 1)) - MALLOC_ALIGN)
+
+/* every pool starts with one of these, heap_print_stats walks them */
+typedef struct pool {
+    struct pool* next;
+    size_t bytes;
+} pool_t;
+
+#define POOL_HDR    ALIGN_UP(sizeof(pool_t), MALLOC_ALIGN)
+
+#if HEAP_STATS
+#define STAT(x) do { x; } while (0)
+static struct {
+    size_t live_bytes;
+    size_t peak_bytes;
+    size_t free_bytes;
+    size_t pool_bytes;
+    uint32_t live_blocks;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+    uint32_t class_allocs[FL_COUNT];
+} stats;
+#else
+#define STAT(x) do { } while (0)
+#endif
+
+static pool_t* pools = NULL;
+static uint32_t fl_bitmap;
+static uint32_t sl_bitmap[FL_COUNT];
+static block_t* blocks[FL_COUNT][SL_COUNT];
 static int is_init = 0;
 
+static inline int fls32(uint32_t x) { return 31 - __builtin_clz(x); }
+static inline int ffs32(uint32_t x) { return __builtin_ctz(x); }
+
+static inline size_t block_size(const block_t* b) { return b->size & ~BLOCK_FREE; }
+static inline int block_is_free(const block_t* b) { return (b->size & BLOCK_FREE) != 0; }
+static inline void* block_to_ptr(block_t* b) { return (char*)b + HDR_SIZE; }
+static inline block_t* ptr_to_block(void* p) { return (block_t*)((char*)p - HDR_SIZE); }
+static inline block_t* block_next(block_t* b) {
+    return (block_t*)((char*)b + HDR_SIZE + block_size(b));
+}
+
+/* size -> (fl, sl) of the list the block belongs to */
+static void mapping_insert(size_t size, int* fl, int* sl) {
+    if (size < SMALL_BLOCK) {
+        *fl = 0;
+        *sl = (int)(size / (SMALL_BLOCK / SL_COUNT));
+    } else {
+        int f = fls32((uint32_t)size);
+        *sl = (int)((size >> (f - SL_LOG2)) ^ SL_COUNT);
+        *fl = f - (FL_SHIFT - 1);
+    }
+}
+
+/* size -> first list whose blocks are all big enough */
+static void mapping_search(size_t size, int* fl, int* sl) {
+    if (size >= SMALL_BLOCK)
+        size += ((size_t)1 << (fls32((uint32_t)size) - SL_LOG2)) - 1;
+    mapping_insert(size, fl, sl);
+}
+
+static block_t* search_suitable(int* fl, int* sl) {
+    uint32_t sl_map = sl_bitmap[*fl] & (~0u << *sl);
+    if (!sl_map) {
+        uint32_t fl_map = (*fl + 1 < 32) ? fl_bitmap & (~0u << (*fl + 1)) : 0;
+        if (!fl_map) return NULL;
+        *fl = ffs32(fl_map);
+        sl_map = sl_bitmap[*fl];
+    }
+    *sl = ffs32(sl_map);
+    return blocks[*fl][*sl];
+}
+
+static void insert_free(block_t* b) {
+    int fl, sl;
+    mapping_insert(block_size(b), &fl, &sl);
+    b->prev_free = NULL;
+    b->next_free = blocks[fl][sl];
+    if (b->next_free) b->next_free->prev_free = b;
+    blocks[fl][sl] = b;
+    fl_bitmap |= 1u << fl;
+    sl_bitmap[fl] |= 1u << sl;
+    STAT(stats.free_bytes += block_size(b));
+}
+
+static void remove_free(block_t* b) {
+    int fl, sl;
+    mapping_insert(block_size(b), &fl, &sl);
+    if (b->prev_free) b->prev_free->next_free = b->next_free;
+    else blocks[fl][sl] = b->next_free;
+    if (b->next_free) b->next_free->prev_free = b->prev_free;
+    if (!blocks[fl][sl]) {
+        sl_bitmap[fl] &= ~(1u << sl);
+        if (!sl_bitmap[fl]) fl_bitmap &= ~(1u << fl);
+    }
+    STAT(stats.free_bytes -= block_size(b));
+}
+
+/* cut b down to size, the tail becomes a new free block (not yet listed) */
+static block_t* split(block_t* b, size_t size) {
+    size_t total = block_size(b);
+    if (total < size + HDR_SIZE + BLOCK_MIN) return NULL;
+
+    block_t* rest = (block_t*)((char*)b + HDR_SIZE + size);
+    rest->size = (total - size - HDR_SIZE) | BLOCK_FREE;
+    rest->prev_phys = b;
+    block_next(rest)->prev_phys = rest;
+    b->size = size | (b->size & BLOCK_FREE);
+    return rest;
+}
+
+/* absorb the physical successor of b (already off the free lists) */
+static void absorb_next(block_t* b) {
+    block_t* n = block_next(b);
+    b->size += HDR_SIZE + block_size(n);
+    block_next(b)->prev_phys = b;
+}
+
+/* mark b free, coalesce with free neighbours and put it on its list */
+static void release(block_t* b) {
+    b->size |= BLOCK_FREE;
+
+    block_t* n = block_next(b);
+    if (block_is_free(n)) {
+        remove_free(n);
+        absorb_next(b);
+    }
+    block_t* p = b->prev_phys;
+    if (p && block_is_free(p)) {
+        remove_free(p);
+        absorb_next(p);
+        b = p;
+    }
+    insert_free(b);
+}
+
+/* carve a used block of `size` payload bytes out of the free block b */
+static void* take(block_t* b, size_t size) {
+    b->size &= ~BLOCK_FREE;
+    block_t* rest = split(b, size);
+    if (rest) release(rest);
+    return block_to_ptr(b);
+}
+
+static size_t adjust_size(size_t size) {
+    if (size > BLOCK_MAX) return 0;
+    size = ALIGN_UP(size, MALLOC_ALIGN);
+    return size < BLOCK_MIN ? BLOCK_MIN : size;
+}
+
+static block_t* find_free(size_t size) {
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= FL_COUNT) return NULL;
+    block_t* b = search_suitable(&fl, &sl);
+    if (b) remove_free(b);
+    return b;
+}
+
+void heap_add_pool(void* mem, size_t bytes) {
+    uintptr_t start = ALIGN_UP((uintptr_t)mem, MALLOC_ALIGN);
+    uintptr_t end = ALIGN_DOWN((uintptr_t)mem + bytes, MALLOC_ALIGN);
+    if (end <= start || end - start < POOL_HDR + 2 * HDR_SIZE + BLOCK_MIN) return;
+
+    pool_t* pool = (pool_t*)start;
+    pool->bytes = end - start;
+    pool->next = pools;
+    pools = pool;
+    STAT(stats.pool_bytes += pool->bytes);
+    start += POOL_HDR;
+
+    size_t size = end - start - 2 * HDR_SIZE;
+    if (size > BLOCK_MAX) size = BLOCK_MAX;
+
+    block_t* b = (block_t*)start;
+    b->prev_phys = NULL;
+    b->size = size | BLOCK_FREE;
+
+    /* zero sized, permanently used sentinel so merging stops at the pool end */
+    block_t* sentinel = block_next(b);
+    sentinel->prev_phys = b;
+    sentinel->size = 0;
+
+    insert_free(b);
+}
+
+/* pull a pool big enough for one `size` block in from the page allocator */
+static int heap_grow(size_t size) {
+    /* the pool is one free block, it has to land in a list mapping_search() checks */
+    if (size >= SMALL_BLOCK)
+        size += ((size_t)1 << (fls32((uint32_t)size) - SL_LOG2)) - 1;
+    size_t need = size + 2 * HDR_SIZE;
+    if (need < HEAP_GROW_MIN) need = HEAP_GROW_MIN;
+
+    unsigned int order = 0;
+    while (((size_t)PAGE_SIZE << order) < need) {
+        if (++order > PMM_MAX_ORDER) return 0;
+    }
+
+    void* mem = pmm_alloc_pages(order);
+    if (!mem) return 0;
+    heap_add_pool(mem, (size_t)PAGE_SIZE << order);
+    return 1;
+}
+
 void heap_init() {
     if (is_init == 1) return;
     is_init = 1;
-    free_list->size = &_heap_end - (char*)free_list - sizeof(block_t);
-    free_list->next = NULL;
+    heap_add_pool(&_heap_start, (size_t)(&_heap_end - &_heap_start));
 }
 
-void* malloc(size_t size) {
+/* bookkeeping for a block that was just handed out */
+static void* allocated(block_t* b, void* caller) {
+    (void)caller;
+#if HEAP_TRACK_CALLERS
+    b->caller = caller;
+#endif
+#if HEAP_STATS
+    int fl, sl;
+    mapping_insert(block_size(b), &fl, &sl);
+    stats.class_allocs[fl]++;
+    stats.allocs++;
+    stats.live_blocks++;
+    stats.live_bytes += block_size(b);
+    if (stats.live_bytes > stats.peak_bytes) stats.peak_bytes = stats.live_bytes;
+#endif
+    return block_to_ptr(b);
+}
+
+static void* heap_alloc(size_t size, void* caller) {
     size_t real_size = size;
-    size = (size + 7) & ~7;
+    size = adjust_size(size);
 
     heap_init();
 
-    block_t** curr = &free_list;
-    while (*curr) {
-        if ((*curr)->size >= size + sizeof(block_t) + 8) {
-            block_t* new_block = (block_t*)((char*)(*curr) + sizeof(block_t) + size);
-            new_block->size = (*curr)->size - size - sizeof(block_t);
-            new_block->next = (*curr)->next;
+    block_t* b = size ? find_free(size) : NULL;
+    if (!b && size && heap_grow(size)) b = find_free(size);
+    if (b) return allocated(ptr_to_block(take(b, size)), caller);
 
-            void* ptr = (char*)(*curr) + sizeof(block_t);
+    STAT(stats.failures++);
+    DEBUG_PRINT("[malloc] failed to allocate buffer of real size %u bytes, size %u bytes\n", real_size, size);
+    return NULL; // Out of memory
+}
 
-            // Replace current block in free list with new_block
-            *curr = new_block;
+static void heap_free(void* ptr) {
+    block_t* block = ptr_to_block(ptr);
+#if HEAP_STATS
+    stats.frees++;
+    stats.live_blocks--;
+    stats.live_bytes -= block_size(block);
+#endif
+    release(block);
+}
 
-            return ptr;
-        } else {
-            void* ptr = (char*)(*curr) + sizeof(block_t);
-            *curr = (*curr)->next;
-            return ptr;
-        }
-        curr = &(*curr)->next;
+void* malloc(size_t size) {
+    return heap_alloc(size, __builtin_return_address(0));
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    if (alignment <= MALLOC_ALIGN) return heap_alloc(size, __builtin_return_address(0));
+    if (alignment & (alignment - 1)) return NULL;
+
+    size = adjust_size(size);
+    if (!size || size > BLOCK_MAX - alignment - HDR_SIZE - BLOCK_MIN) return NULL;
+
+    heap_init();
+
+    /* room for the worst case gap in front, which must itself hold a free block */
+    size_t search = size + alignment + HDR_SIZE + BLOCK_MIN;
+    block_t* b = find_free(search);
+    if (!b && heap_grow(search)) b = find_free(search);
+    if (!b) {
+        STAT(stats.failures++);
+        return NULL;
     }
 
-    DEBUG_PRINT("[malloc] failed to allocate buffer of real size %u bytes, size %u bytes\n", real_size, size);
-    return NULL; // Out of memory
+    uintptr_t p = (uintptr_t)block_to_ptr(b);
+    uintptr_t aligned = ALIGN_UP(p, alignment);
+    if (aligned != p && aligned - p < HDR_SIZE + BLOCK_MIN)
+        aligned = ALIGN_UP(p + HDR_SIZE + BLOCK_MIN, alignment);
+
+    if (aligned != p) {
+        /* give the gap in front back to the heap as its own block */
+        block_t* front = b;
+        b = ptr_to_block((void*)aligned);
+        size_t gap = (char*)b - (char*)front;
+        b->size = block_size(front) - gap;
+        b->prev_phys = front;
+        block_next(b)->prev_phys = b;
+        front->size = (gap - HDR_SIZE) | BLOCK_FREE;
+        release(front);
+    }
+    return allocated(ptr_to_block(take(b, size)), __builtin_return_address(0));
 }
 
 void free(void* ptr) {
     if (!ptr) return;
-    block_t* block = (block_t*)((char*)ptr - sizeof(block_t));
-    DEBUG_PRINT("[malloc] freed %u byte big buffer\n", block->size);
-    block->next = free_list;
-    free_list = block;
+    heap_free(ptr);
 }
 
 void* calloc(size_t num, size_t size) {
+    if (size && num > (size_t)-1 / size) return NULL;
     size_t total = num * size;
-    void* ptr = malloc(total);
+    void* ptr = heap_alloc(total, __builtin_return_address(0));
     if (!ptr) return NULL;
     memset(ptr, 0, total);
     return ptr;
 }
 
+/* resize a used block without moving it, 0 if the neighbour has no room */
+static int resize_in_place(block_t* b, size_t size) {
+    size_t old_size = block_size(b);
+
+    if (size > old_size) {
+        block_t* n = block_next(b);
+        if (!block_is_free(n) || old_size + HDR_SIZE + block_size(n) < size) return 0;
+        remove_free(n);
+        absorb_next(b);
+    }
+
+    /* whatever is left over goes back, merging with a free successor */
+    block_t* rest = split(b, size);
+    if (rest) release(rest);
+
+    STAT(stats.live_bytes += block_size(b) - old_size);
+    STAT(if (stats.live_bytes > stats.peak_bytes) stats.peak_bytes = stats.live_bytes);
+    return 1;
+}
+
 void* realloc(void* ptr, size_t new_size) {
-    if (!ptr) return malloc(new_size);   // behave like malloc
-    if (new_size == 0) {                 // behave like free
-        free(ptr);
+    void* caller = __builtin_return_address(0);
+    if (!ptr) return heap_alloc(new_size, caller);   // behave like malloc
+    if (new_size == 0) {                             // behave like free
+        heap_free(ptr);
         return NULL;
     }
 
-    void* new_ptr = malloc(new_size);
+    size_t size = adjust_size(new_size);
+    if (!size) return NULL;
+
+    /* shrink, or grow into a free physical neighbour */
+    block_t* b = ptr_to_block(ptr);
+    if (resize_in_place(b, size)) return ptr;
+
+    void* new_ptr = heap_alloc(new_size, caller);
     if (!new_ptr) return NULL;
 
-    memcpy(new_ptr, ptr, new_size);
-    free(ptr);
+    memcpy(new_ptr, ptr, block_size(b));
+    heap_free(ptr);
     return new_ptr;
-}
\ No newline at end of file
+}
+
+size_t malloc_usable_size(void* ptr) {
+    return ptr ? block_size(ptr_to_block(ptr)) : 0;
+}
+
+void* malloc_sized(size_t size, size_t* usable) {
+    void* ptr = heap_alloc(size, __builtin_return_address(0));
+    if (usable) *usable = ptr ? block_size(ptr_to_block(ptr)) : 0;
+    return ptr;
+}
+
+void free_sized(void* ptr, size_t size) {
+    if (!ptr) return;
+#if GLOBAL_DEBUG
+    size_t have = block_size(ptr_to_block(ptr));
+    if (size > have || adjust_size(size) + HDR_SIZE + BLOCK_MIN <= have) {
+        DEBUG_PRINT("[malloc] free_sized(%p, %u) on a %u byte block\n", ptr, (unsigned int)size, (unsigned int)have);
+    }
+#else
+    (void)size;
+#endif
+    heap_free(ptr);
+}
+
+/* ---------------- statistics ---------------- */
+
+size_t heap_largest_free(void) {
+    if (!fl_bitmap) return 0;
+    int fl = fls32(fl_bitmap);
+    int sl = fls32(sl_bitmap[fl]);
+    size_t largest = 0;
+    for (block_t* b = blocks[fl][sl]; b; b = b->next_free) {
+        if (block_size(b) > largest) largest = block_size(b);
+    }
+    return largest;
+}
+
+#if HEAP_STATS
+
+/* fraction of the free memory that is not in the largest free block */
+static unsigned int fragmentation_permille(size_t largest, size_t total) {
+    if (!total) return 0;
+    while (total > 4000000u) { total >>= 1; largest >>= 1; }
+    return 1000u - (unsigned int)(largest * 1000u / total);
+}
+
+#if HEAP_TRACK_CALLERS
+#define TOP_CALLERS 8
+
+typedef struct {
+    void* caller;
+    size_t bytes;
+    uint32_t blocks;
+} caller_stat_t;
+
+/* group live blocks by allocation site, biggest first */
+static void print_callers(void) {
+    caller_stat_t top[TOP_CALLERS];
+    uint32_t used = 0;
+    size_t other_bytes = 0;
+    memset(top, 0, sizeof(top));
+
+    for (pool_t* pool = pools; pool; pool = pool->next) {
+        block_t* b = (block_t*)((char*)pool + POOL_HDR);
+        for (; block_size(b); b = block_next(b)) {   /* the sentinel is 0 sized */
+            if (block_is_free(b)) continue;
+            uint32_t i = 0;
+            while (i < used && top[i].caller != b->caller) i++;
+            if (i == used) {
+                if (used == TOP_CALLERS) { other_bytes += block_size(b); continue; }
+                top[used++].caller = b->caller;
+            }
+            top[i].bytes += block_size(b);
+            top[i].blocks++;
+        }
+    }
+
+    for (uint32_t i = 1; i < used; i++) {
+        caller_stat_t t = top[i];
+        uint32_t j = i;
+        for (; j > 0 && top[j - 1].bytes < t.bytes; j--) top[j] = top[j - 1];
+        top[j] = t;
+    }
+
+    printf("live allocations by call site:\n");
+    for (uint32_t i = 0; i < used; i++) {
+        printf("  %p %10u bytes in %u blocks\n", top[i].caller,
+               (unsigned int)top[i].bytes, top[i].blocks);
+    }
+    if (other_bytes) printf("  (other)    %10u bytes\n", (unsigned int)other_bytes);
+}
+#endif
+
+void heap_print_stats(void) {
+    heap_init();
+
+    uint32_t npools = 0;
+    for (pool_t* pool = pools; pool; pool = pool->next) npools++;
+
+    size_t largest = heap_largest_free();
+    unsigned int frag = fragmentation_permille(largest, stats.free_bytes);
+
+    printf("heap:  %u KiB in %u pools\n", (unsigned int)(stats.pool_bytes >> 10), npools);
+    printf("live:  %u bytes in %u blocks, peak %u bytes\n",
+           (unsigned int)stats.live_bytes, stats.live_blocks, (unsigned int)stats.peak_bytes);
+    printf("free:  %u bytes, largest block %u bytes, fragmentation %u.%u%%\n",
+           (unsigned int)stats.free_bytes, (unsigned int)largest, frag / 10, frag % 10);
+    printf("calls: %u allocs, %u frees, %u failed\n", stats.allocs, stats.frees, stats.failures);
+
+    printf("allocs by size:");
+    for (int fl = 0; fl < FL_COUNT; fl++) {
+        if (!stats.class_allocs[fl]) continue;
+        printf(" <%u:%u", (unsigned int)SMALL_BLOCK << fl, stats.class_allocs[fl]);
+    }
+    printf("\n");
+
+#if HEAP_TRACK_CALLERS
+    print_callers();
+#endif
+}
+
+#else
+
+void heap_print_stats(void) {
+    printf("heap statistics compiled out (HEAP_STATS=0), largest free block %u bytes\n",
+           (unsigned int)heap_largest_free());
+}
+
+#endif
@@ -5,44 +5,122 @@
 #include <stdio.h>
 #include <string.h>
 #include <cyrillic.h>
-
-void *memcpy(void *dest, const void *src, size_t n) {
+#include <cpu.h>
+
+/* ---------------- Word-at-a-time helpers ----------------
+ * Scanning loops read a machine word at a time and use the classic
+ * has-zero-byte test: (w - 0x0101..) & ~w & 0x8080.. is non-zero iff some
+ * byte of w is 0. Reads past the terminating NUL are only ever aligned
+ * (or checked not to cross a page), so they cannot fault.
+ */
+
+typedef uintptr_t __attribute__((may_alias)) word_t;
+typedef uintptr_t __attribute__((may_alias, aligned(1))) uword_t;   /* unaligned */
+
+#define WORD_SIZE   sizeof(word_t)
+#define ONES        ((word_t)-1 / 0xFF)
+#define HIGHS       (ONES * 0x80)
+#define HAS_ZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+#define SCAN_PAGE   4096u
+
+/* ---------------- Memory functions ----------------
+ * memcpy/memset are alternatives (cpu.h), patched once at boot:
+ *  - ERMSB (enhanced rep movsb/stosb): the microcoded string ops are the
+ *    fastest thing for anything that is not huge
+ *  - SSE2: copies/fills of MEM_NT_THRESHOLD bytes and up use non-temporal
+ *    16 byte stores, they do not drag the destination through the cache
+ *  - otherwise an unrolled 32-bit loop
+ * Until cpu_init() has run the 32-bit loops are used.
+ */
+
+#define MEM_NT_THRESHOLD (64u * 1024u)
+
+/* the short-copy path of the SSE2 versions, ERMS or not */
+void *memcpy_small(void *dest, const void *src, size_t n);
+void *memset_small(void *pointer, int value, size_t count);
+
+ALT_IMPL static void *memcpy_words(void *dest, const void *src, size_t n) {
     unsigned char *d = dest;
     const unsigned char *s = src;
+
+    while (n && ((uintptr_t)d & 3)) { *d++ = *s++; n--; }
+
+    uint32_t *dw = (uint32_t *)d;
+    const uint32_t *sw = (const uint32_t *)s;
+    while (n >= 16) {
+        uint32_t a = sw[0], b = sw[1], c = sw[2], e = sw[3];
+        dw[0] = a; dw[1] = b; dw[2] = c; dw[3] = e;
+        dw += 4; sw += 4; n -= 16;
+    }
+    while (n >= 4) { *dw++ = *sw++; n -= 4; }
+
+    d = (unsigned char *)dw;
+    s = (const unsigned char *)sw;
     while (n--) *d++ = *s++;
     return dest;
 }
 
-void *memmove(void *dest, const void *src, size_t n) {
+ALT_IMPL static void *memcpy_erms(void *dest, const void *src, size_t n) {
+    void *d = dest;
+    __asm__ volatile ("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+    return dest;
+}
+
+/* forward copy, safe for overlap with dest < src: each 64 byte chunk is
+   loaded completely before any of it is stored */
+ALT_IMPL SSE2_FN static void *memcpy_sse2(void *dest, const void *src, size_t n) {
+    if (n < MEM_NT_THRESHOLD) return memcpy_small(dest, src, n);
+
     unsigned char *d = dest;
     const unsigned char *s = src;
-    if (d < s) {
-        while (n--) *d++ = *s++;
-    } else if (d > s) {
-        d += n; s += n;
-        while (n--) *--d = *--s;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    memcpy_small(d, s, head);
+    d += head; s += head; n -= head;
+
+    size_t chunks = n / 64;
+    if (chunks) {
+        __asm__ volatile (
+            "1:\n\t"
+            "movdqu   0(%1), %%xmm0\n\t"
+            "movdqu  16(%1), %%xmm1\n\t"
+            "movdqu  32(%1), %%xmm2\n\t"
+            "movdqu  48(%1), %%xmm3\n\t"
+            "movntdq %%xmm0,  0(%0)\n\t"
+            "movntdq %%xmm1, 16(%0)\n\t"
+            "movntdq %%xmm2, 32(%0)\n\t"
+            "movntdq %%xmm3, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "add $64, %1\n\t"
+            "dec %2\n\t"
+            "jnz 1b\n\t"
+            "sfence"
+            : "+r"(d), "+r"(s), "+r"(chunks)
+            :
+            : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
     }
+    memcpy_small(d, s, n & 63);
     return dest;
 }
 
-void *memset(void *pointer, int value, size_t count) {
+ALT_IMPL static void *memset_words(void *pointer, int value, size_t count) {
     uint8_t *p = (uint8_t*)pointer;
     uint8_t byte = (uint8_t)value;
 
-    while (count && ((uintptr_t)p % sizeof(uintptr_t))) {
+    while (count && ((uintptr_t)p & 3)) {
         *p++ = byte;
         count--;
     }
 
-    uintptr_t word = 0;
-    for (size_t i = 0; i < sizeof(uintptr_t); i++) {
-        word = (word << 8) | byte;
+    uint32_t word = byte * 0x01010101u;
+    uint32_t *pw = (uint32_t*)p;
+    while (count >= 16) {
+        pw[0] = word; pw[1] = word; pw[2] = word; pw[3] = word;
+        pw += 4;
+        count -= 16;
     }
-
-    uintptr_t *pw = (uintptr_t*)p;
-    while (count >= sizeof(uintptr_t)) {
+    while (count >= 4) {
         *pw++ = word;
-        count -= sizeof(uintptr_t);
+        count -= 4;
     }
     p = (uint8_t*)pw;
     while (count--) {
@@ -52,8 +130,85 @@ void *memset(void *pointer, int value, size_t count) {
     return pointer;
 }
 
+ALT_IMPL static void *memset_erms(void *pointer, int value, size_t count) {
+    void *p = pointer;
+    __asm__ volatile ("rep stosb" : "+D"(p), "+c"(count) : "a"(value) : "memory");
+    return pointer;
+}
+
+ALT_IMPL SSE2_FN static void *memset_sse2(void *pointer, int value, size_t count) {
+    if (count < MEM_NT_THRESHOLD) return memset_small(pointer, value, count);
+
+    uint8_t *p = pointer;
+    size_t head = (16 - ((uintptr_t)p & 15)) & 15;
+    memset_small(p, value, head);
+    p += head; count -= head;
+
+    uint32_t word = (uint8_t)value * 0x01010101u;
+    size_t chunks = count / 64;
+    __asm__ volatile (
+        "movd %2, %%xmm0\n\t"
+        "pshufd $0, %%xmm0, %%xmm0\n\t"
+        "1:\n\t"
+        "movntdq %%xmm0,  0(%0)\n\t"
+        "movntdq %%xmm0, 16(%0)\n\t"
+        "movntdq %%xmm0, 32(%0)\n\t"
+        "movntdq %%xmm0, 48(%0)\n\t"
+        "add $64, %0\n\t"
+        "dec %1\n\t"
+        "jnz 1b\n\t"
+        "sfence"
+        : "+r"(p), "+r"(chunks)
+        : "r"(word)
+        : "xmm0", "memory", "cc");
+    memset_small(p, value, count & 63);
+    return pointer;
+}
+
+ALT_ENTRY(memcpy_small, memcpy_words);
+ALTERNATIVE(memcpy_small, memcpy_erms, CPU_ERMS);
+
+ALT_ENTRY(memset_small, memset_words);
+ALTERNATIVE(memset_small, memset_erms, CPU_ERMS);
+
+ALT_ENTRY(memcpy, memcpy_words);
+ALTERNATIVE(memcpy, memcpy_erms, CPU_ERMS);
+ALTERNATIVE(memcpy, memcpy_sse2, CPU_SSE2);
+
+ALT_ENTRY(memset, memset_words);
+ALTERNATIVE(memset, memset_erms, CPU_ERMS);
+ALTERNATIVE(memset, memset_sse2, CPU_SSE2);
+
+void *memmove(void *dest, const void *src, size_t n) {
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    if (d == s || n == 0) return dest;
+
+    /* forward copies are fine unless dest starts inside src */
+    if (d < s || d >= s + n) return memcpy(dest, src, n);
+
+    d += n; s += n;
+    while (n && ((uintptr_t)d & 3)) { *--d = *--s; n--; }
+    uint32_t *dw = (uint32_t *)d;
+    const uint32_t *sw = (const uint32_t *)s;
+    while (n >= 16) {
+        uint32_t a = sw[-1], b = sw[-2], c = sw[-3], e = sw[-4];
+        dw[-1] = a; dw[-2] = b; dw[-3] = c; dw[-4] = e;
+        dw -= 4; sw -= 4; n -= 16;
+    }
+    while (n >= 4) { *--dw = *--sw; n -= 4; }
+    d = (unsigned char *)dw;
+    s = (const unsigned char *)sw;
+    while (n--) *--d = *--s;
+    return dest;
+}
+
 int memcmp(const void *s1, const void *s2, size_t n) {
     const unsigned char *a = s1, *b = s2;
+    /* skip equal words, the first differing word is settled bytewise */
+    while (n >= WORD_SIZE && *(const uword_t *)a == *(const uword_t *)b) {
+        a += WORD_SIZE; b += WORD_SIZE; n -= WORD_SIZE;
+    }
     for (size_t i = 0; i < n; i++)
         if (a[i] != b[i]) return a[i] - b[i];
     return 0;
@@ -61,12 +216,103 @@ int memcmp(const void *s1, const void *s2, size_t n) {
 
 /* ---------------- String functions ---------------- */
 
-size_t strlen(const char *s) {
+/* strchr without the c == 0 special case, for the loops below */
+char *strchr_scan(const char *s, int c);
+
+ALT_IMPL static size_t strlen_swar(const char *s) {
     const char *p = s;
+    for (; (uintptr_t)p % WORD_SIZE; p++)
+        if (!*p) return p - s;
+
+    const word_t *w = (const word_t *)p;
+    while (!HAS_ZERO(*w)) w++;
+
+    p = (const char *)w;
     while (*p) p++;
     return p - s;
 }
 
+ALT_IMPL static char *strchr_swar(const char *s, int c) {
+    const char ch = (char)c;
+    for (; (uintptr_t)s % WORD_SIZE; s++) {
+        if (*s == ch) return (char *)s;
+        if (!*s) return NULL;
+    }
+
+    const word_t pattern = ONES * (unsigned char)ch;
+    const word_t *w = (const word_t *)s;
+    for (;; w++) {
+        word_t v = *w;
+        if (HAS_ZERO(v) || HAS_ZERO(v ^ pattern)) break;
+    }
+
+    for (s = (const char *)w; *s != ch; s++)
+        if (!*s) return NULL;
+    return (char *)s;
+}
+
+/* SSE2: 16 bytes per compare. Loads are 16 byte aligned, the first one is
+   rounded down and the bytes in front of s are masked off */
+ALT_IMPL SSE2_FN static size_t strlen_sse2(const char *s) {
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+    unsigned int mask;
+    __asm__ volatile (
+        "pxor %%xmm0, %%xmm0\n\t"
+        "movdqa (%1), %%xmm1\n\t"
+        "pcmpeqb %%xmm0, %%xmm1\n\t"
+        "pmovmskb %%xmm1, %0"
+        : "=r"(mask) : "r"(p) : "xmm0", "xmm1", "memory");
+    mask >>= (s - p);
+    if (mask) return __builtin_ctz(mask);
+
+    for (;;) {
+        p += 16;
+        __asm__ volatile (
+            "pxor %%xmm0, %%xmm0\n\t"
+            "pcmpeqb (%1), %%xmm0\n\t"
+            "pmovmskb %%xmm0, %0"
+            : "=r"(mask) : "r"(p) : "xmm0", "memory");
+        if (mask) return (size_t)(p - s) + __builtin_ctz(mask);
+    }
+}
+
+ALT_IMPL SSE2_FN static char *strchr_sse2(const char *s, int c) {
+    const char ch = (char)c;
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+    uint32_t pattern = (unsigned char)ch * 0x01010101u;
+    unsigned int mask;
+
+    /* mask = bytes that are NUL or ch */
+    #define STRCHR_BLOCK(ptr) \
+        __asm__ volatile ( \
+            "movd %2, %%xmm2\n\t" \
+            "pshufd $0, %%xmm2, %%xmm2\n\t" \
+            "pxor %%xmm0, %%xmm0\n\t" \
+            "movdqa (%1), %%xmm1\n\t" \
+            "pcmpeqb %%xmm1, %%xmm0\n\t" \
+            "pcmpeqb %%xmm2, %%xmm1\n\t" \
+            "por %%xmm1, %%xmm0\n\t" \
+            "pmovmskb %%xmm0, %0" \
+            : "=r"(mask) : "r"(ptr), "r"(pattern) : "xmm0", "xmm1", "xmm2", "memory")
+
+    STRCHR_BLOCK(p);
+    mask = (mask >> (s - p)) << (s - p);
+    while (!mask) {
+        p += 16;
+        STRCHR_BLOCK(p);
+    }
+    #undef STRCHR_BLOCK
+
+    p += __builtin_ctz(mask);
+    return *p == ch ? (char *)p : NULL;
+}
+
+ALT_ENTRY(strlen, strlen_swar);
+ALTERNATIVE(strlen, strlen_sse2, CPU_SSE2);
+
+ALT_ENTRY(strchr_scan, strchr_swar);
+ALTERNATIVE(strchr_scan, strchr_sse2, CPU_SSE2);
+
 char *strcpy(char *dest, const char *src) {
     char *d = dest;
     while ((*d++ = *src++));
@@ -101,6 +347,27 @@ char *strncat(char *dest, const char *src, size_t n) {
 }
 
 int strcmp(const char *s1, const char *s2) {
+    for (; (uintptr_t)s1 % WORD_SIZE; s1++, s2++) {
+        if (*s1 != *s2 || !*s1)
+            return *(unsigned char *)s1 - *(unsigned char *)s2;
+    }
+
+    /* s1 is aligned, s2 may not be: its word read is only done when it
+       stays inside s2's current page */
+    for (;;) {
+        if (((uintptr_t)s2 & (SCAN_PAGE - 1)) > SCAN_PAGE - WORD_SIZE) {
+            for (size_t i = 0; i < WORD_SIZE; i++, s1++, s2++) {
+                if (*s1 != *s2 || !*s1)
+                    return *(unsigned char *)s1 - *(unsigned char *)s2;
+            }
+            continue;
+        }
+        word_t a = *(const word_t *)s1;
+        if (a != *(const uword_t *)s2 || HAS_ZERO(a)) break;
+        s1 += WORD_SIZE;
+        s2 += WORD_SIZE;
+    }
+
     while (*s1 && (*s1 == *s2)) { s1++; s2++; }
     return *(unsigned char *)s1 - *(unsigned char *)s2;
 }
@@ -113,25 +380,71 @@ int strncmp(const char *s1, const char *s2, size_t n) {
 }
 
 char *strchr(const char *s, int c) {
-    for (; *s; s++)
-        if (*s == (char)c) return (char *)s;
-    return c == 0 ? (char *)s : NULL;
+    if ((char)c == 0) return (char *)s + strlen(s);
+    return strchr_scan(s, c);
 }
 
 char *strrchr(const char *s, int c) {
+    if ((char)c == 0) return (char *)s + strlen(s);
     const char *last = NULL;
-    for (; *s; s++)
-        if (*s == (char)c) last = s;
-    if (c == 0) return (char *)s;
+    for (const char *p = s; (p = strchr_scan(p, c)); p++)
+        last = p;
     return (char *)last;
 }
 
+/* length of s, but look at no more than max bytes */
+static size_t strnlen_swar(const char *s, size_t max) {
+    const char *p = s;
+    for (; max && (uintptr_t)p % WORD_SIZE; p++, max--)
+        if (!*p) return p - s;
+
+    const word_t *w = (const word_t *)p;
+    for (; max >= WORD_SIZE && !HAS_ZERO(*w); w++) max -= WORD_SIZE;
+
+    for (p = (const char *)w; max && *p; p++, max--);
+    return p - s;
+}
+
+/* Horspool over a haystack whose end is only discovered as the window moves:
+   z is how far h is known to be NUL free, the window never goes past it */
+static char *strstr_horspool(const unsigned char *h, const unsigned char *n, size_t l) {
+    size_t shift[256];
+    for (size_t i = 0; i < 256; i++) shift[i] = l;
+    for (size_t i = 0; i + 1 < l; i++) shift[n[i]] = l - 1 - i;
+
+    const unsigned char *z = h;
+    for (;;) {
+        if ((size_t)(z - h) < l) {
+            size_t grow = l | 63;
+            size_t got = strnlen_swar((const char *)z, grow);
+            z += got;
+            if (got < grow && (size_t)(z - h) < l) return NULL;
+        }
+
+        unsigned char last = h[l - 1];
+        if (last == n[l - 1] && memcmp(h, n, l - 1) == 0) return (char *)h;
+        h += shift[last];
+    }
+}
+
+#define STRSTR_HORSPOOL_MIN 8
+
 char *strstr(const char *haystack, const char *needle) {
     if (!*needle) return (char *)haystack;
-    for (; *haystack; haystack++) {
-        const char *h = haystack, *n = needle;
-        while (*h && *n && *h == *n) { h++; n++; }
-        if (!*n) return (char *)haystack;
+
+    /* candidates start with needle[0], let the word/SSE2 scan find them */
+    const char *h = strchr_scan(haystack, needle[0]);
+    if (!h || !needle[1]) return (char *)h;
+
+    size_t l = strlen(needle);
+    if (l >= STRSTR_HORSPOOL_MIN)
+        return strstr_horspool((const unsigned char *)h, (const unsigned char *)needle, l);
+
+    for (; h; h = strchr_scan(h + 1, needle[0])) {
+        size_t i = 1;
+        while (needle[i] && h[i] == needle[i]) i++;
+        if (!needle[i]) return (char *)h;
+        if (!h[i]) return NULL;
     }
     return NULL;
 }
@@ -1,7 +1,7 @@
 // text.c -- framebuffer text output + minimal printf family
 // Multi-byte mapping: single byte 0..127 = glyph 0..127
 // if byte >= 128 then use (b1,b2) -> index = 128 + (b1-128)*256 + b2
-// Max glyphs = 32896, each glyph = 16 bytes => 32896*16 = 526336 bytes
+// Max glyphs = 32896, each glyph = 16 bytes, stored sparsely in 256 glyph blocks
 
 #include <stdint.h>
 #include <stdarg.h>
@@ -11,12 +11,9 @@
 #include <string.h>
 
 #include <text.h>
+#include <console.h>
 #include <vesa.h>  // expects set_pixel, clear_screen, vesa_mode_info, CHAR_WIDTH, CHAR_HEIGHT
 
-/* ——— Font data ——— */
-/* font: pointer to array of glyphs; each glyph = 16 bytes (rows) */
-static uint8_t (*font)[16] = NULL;
-
 /* base_font: 256 glyphs x 16 bytes each (BIOS / fallback) */
 uint8_t base_font[256][16];
 
@@ -26,31 +23,84 @@ uint8_t base_font[256][16];
 #define EXT_BLOCK_WIDTH 256U   /* b2 = 0..255 */
 #define NUM_GLYPHS (SINGLE_BYTE_LIMIT + (EXT_BLOCKS * EXT_BLOCK_WIDTH)) /* 32896 */
 #define GLYPH_BYTES 16U
-#define FONT_BYTES (NUM_GLYPHS * GLYPH_BYTES) /* 526336 */
 
-/* Cursor */
+/* ——— Font data ———
+ * Two levels: glyph g is font_blocks[g >> 8][g & 0xFF]. Block 0 is the BIOS
+ * font itself; every other block starts out pointing at one shared block of
+ * '?' glyphs and gets its own 4 KiB copy on the first set_glyph() into it.
+ * Lookups never branch on whether a block exists.
+ */
+#define FONT_BLOCK_SHIFT 8
+#define FONT_BLOCK_GLYPHS (1U << FONT_BLOCK_SHIFT)
+#define FONT_BLOCKS ((NUM_GLYPHS + FONT_BLOCK_GLYPHS - 1) / FONT_BLOCK_GLYPHS)   /* 129 */
+
+static uint8_t (*font_blocks[FONT_BLOCKS])[GLYPH_BYTES];
+static uint8_t fallback_block[FONT_BLOCK_GLYPHS][GLYPH_BYTES];
+
+/* Cursor, cursor_x == max_cols while a wrap is pending */
 int cursor_x = 0;
 int cursor_y = 0;
 
-/* Colors */
-static uint8_t fg_r = 255, fg_g = 255, fg_b = 255;
-static uint8_t bg_r = 0, bg_g = 0, bg_b = 0;
+/* ——— Colours ———
+ * Cells carry palette indices. The palette keeps every colour as RGB and as
+ * the native pixel value of the current mode, entries are added the first
+ * time set_text_color() asks for a colour and never change after that.
+ * set_text_color() only picks the indices new output is written with,
+ * nothing already on screen is touched.
+ */
+#define PALETTE_SIZE 256
+static uint8_t palette_rgb[PALETTE_SIZE][3] = { { 255, 255, 255 }, { 0, 0, 0 } };
+static uint32_t palette_native[PALETTE_SIZE];
+static int palette_used = 2;
+static const fb_ops_t *palette_ops = NULL;  /* format palette_native is for, NULL = stale */
+static uint8_t cur_fg = 0, cur_bg = 1;
 
 /* Max rows/cols computed from VESA */
 static int max_cols = 0;
 static int max_rows = 0;
+static uint16_t max_for_x = 0, max_for_y = 0;   /* resolution max_* belong to */
 
-/* Screen buffer now holds glyph indices (uint16_t is enough: 0..32895) */
+/* Screen buffer cells: glyph index (0..32895) in the low 16 bits, then the
+   foreground and background palette indices.
+   It is a ring of max_rows rows: screen row y lives in buffer row
+   (top_row + y) % max_rows, so scrolling just moves top_row */
 #define MAX_ROWS 128
 #define MAX_COLS 256
-static uint16_t screen_buffer[MAX_ROWS * MAX_COLS];
+typedef uint32_t cell_t;
+#define CELL(glyph, fg, bg) ((cell_t)(glyph) | (cell_t)(fg) << 16 | (cell_t)(bg) << 24)
+#define CELL_GLYPH(c)       ((uint16_t)(c))
+#define CELL_FG(c)          ((uint8_t)((c) >> 16))
+#define CELL_BG(c)          ((uint8_t)((c) >> 24))
+#define BLANK_CELL()        CELL(' ', cur_fg, cur_bg)
+static cell_t screen_buffer[MAX_ROWS * MAX_COLS];
+static int top_row = 0;
+
+/* ——— Scrollback ———
+ * Rows that scroll off the top of the screen go into a ring of
+ * SCROLLBACK_LINES rows of cells, allocated once by text_init() for the
+ * width of the mode (a wider mode later gets fewer lines out of the same
+ * memory, any width change empties it). view_offset > 0 shows the screen
+ * that many lines back in history; any output returns to the live screen.
+ */
+static cell_t *history = NULL;
+static size_t history_cells = 0;    /* capacity of history */
+static int hist_cols = 0;           /* row width stored, 0 = empty */
+static int hist_lines = 0;          /* rows the ring holds at that width */
+static int hist_head = 0;           /* next row written */
+static int hist_count = 0;
+static int view_offset = 0;
 
 /* Forward declarations */
 void redraw_from_buffer(void);
 void update_max(void);
 
-/* Helper: update max rows/cols according to VESA resolution */
+/* Helper: update max rows/cols according to VESA resolution, only does
+   work when the mode changed since the last call */
 void update_max(void) {
+    if (max_cols && vesa_mode_info.XResolution == max_for_x && vesa_mode_info.YResolution == max_for_y)
+        return;
+    max_for_x = vesa_mode_info.XResolution;
+    max_for_y = vesa_mode_info.YResolution;
     if (vesa_mode_info.XResolution > 0 && vesa_mode_info.YResolution > 0) {
         int cols = vesa_mode_info.XResolution / CHAR_WIDTH;
         int rows = vesa_mode_info.YResolution / CHAR_HEIGHT;
@@ -58,6 +108,7 @@ void update_max(void) {
         if (rows <= 0) rows = 25;
         if (cols > MAX_COLS) cols = MAX_COLS;
         if (rows > MAX_ROWS) rows = MAX_ROWS;
+        if (cols != max_cols || rows != max_rows) top_row = 0;
         max_cols = cols;
         max_rows = rows;
     } else {
@@ -66,441 +117,937 @@ void update_max(void) {
     }
 }
 
-/* low-level: draw glyph at framebuffer coordinates (cx,cy grid) */
-static void draw_glyph_at_cell(uint16_t glyph_index, int cx, int cy) {
-    if (!font) return; /* nothing loaded */
-    if (glyph_index >= NUM_GLYPHS) glyph_index = (uint16_t)'?'; /* fallback to '?' index in first 128 */
+/* buffer row holding screen row y */
+static inline cell_t *row_cells(int y) {
+    int r = top_row + y;
+    if (r >= max_rows) r -= max_rows;
+    return &screen_buffer[r * max_cols];
+}
+
+/* index of r, g, b in the palette, added if new; once the palette is full
+   the closest colour in it */
+static uint8_t palette_index(uint8_t r, uint8_t g, uint8_t b) {
+    for (int i = 0; i < palette_used; ++i) {
+        if (palette_rgb[i][0] == r && palette_rgb[i][1] == g && palette_rgb[i][2] == b)
+            return (uint8_t)i;
+    }
+    if (palette_used < PALETTE_SIZE) {
+        int i = palette_used++;
+        palette_rgb[i][0] = r; palette_rgb[i][1] = g; palette_rgb[i][2] = b;
+        palette_native[i] = fb_ops->color(r, g, b);
+        return (uint8_t)i;
+    }
+
+    int best = 0, best_dist = 3 * 256;
+    for (int i = 0; i < PALETTE_SIZE; ++i) {
+        int dr = palette_rgb[i][0] - r, dg = palette_rgb[i][1] - g, db = palette_rgb[i][2] - b;
+        int dist = (dr < 0 ? -dr : dr) + (dg < 0 ? -dg : dg) + (db < 0 ? -db : db);
+        if (dist < best_dist) { best = i; best_dist = dist; }
+    }
+    return (uint8_t)best;
+}
+
+/* ——— Glyph tables ———
+ * fb_ops->glyph_rows() expands a colour pair into a table of the 256 glyph
+ * rows in the framebuffer's format, and fb_ops->glyph() draws a glyph as 16
+ * row copies out of it. Tables for the last few colour pairs are kept, so
+ * coloured text costs the same as plain text; all of them go when the
+ * drawing ops change.
+ */
+typedef fb_glyph_row_t glyph_row_t;
+
+#define GLYPH_TABLES 4
+#define TABLE_VALID  0x10000u
 
-    const uint8_t *bitmap = font[glyph_index];
+static glyph_row_t glyph_rows[GLYPH_TABLES][256] __attribute__((aligned(16)));
+static uint32_t table_key[GLYPH_TABLES];    /* TABLE_VALID | fg | bg << 8 */
+static unsigned int table_last = 0, table_next = 0;
+
+/* native colours and tables follow the mode */
+static inline void check_format(void) {
+    if (palette_ops == fb_ops) return;
+    for (int i = 0; i < palette_used; ++i)
+        palette_native[i] = fb_ops->color(palette_rgb[i][0], palette_rgb[i][1], palette_rgb[i][2]);
+    memset(table_key, 0, sizeof(table_key));
+    palette_ops = fb_ops;
+}
+
+static glyph_row_t *glyph_table(uint8_t fg, uint8_t bg) {
+    uint32_t key = TABLE_VALID | fg | (uint32_t)bg << 8;
+    if (table_key[table_last] == key) return glyph_rows[table_last];
+    for (unsigned int i = 0; i < GLYPH_TABLES; ++i) {
+        if (table_key[i] == key) {
+            table_last = i;
+            return glyph_rows[i];
+        }
+    }
+
+    unsigned int i = table_next;
+    table_next = (table_next + 1) % GLYPH_TABLES;
+    fb_ops->glyph_rows(glyph_rows[i], palette_native[fg], palette_native[bg]);
+    table_key[i] = key;
+    table_last = i;
+    return glyph_rows[i];
+}
+
+static inline const uint8_t *glyph_bitmap(uint16_t glyph) {
+    if (glyph >= NUM_GLYPHS) glyph = (uint16_t)'?'; /* fallback to '?' index in first 128 */
+    return font_blocks[glyph >> FONT_BLOCK_SHIFT][glyph & (FONT_BLOCK_GLYPHS - 1)];
+}
+
+/* low-level: draw n cells of grid row cy starting at column cx, with one
+   damage rect for all of them. max_* must be current */
+static void draw_cells(int cx, int cy, const cell_t *cells, int n) {
+    if (!font_blocks[0]) return; /* nothing loaded */
     const int px = cx * CHAR_WIDTH;
     const int py = cy * CHAR_HEIGHT;
+    if (py + CHAR_HEIGHT > vesa_mode_info.YResolution) return;
+    if (px + n * CHAR_WIDTH > vesa_mode_info.XResolution) n = (vesa_mode_info.XResolution - px) / CHAR_WIDTH;
+    if (n <= 0) return;
 
-    for (int row = 0; row < CHAR_HEIGHT; ++row) {
-        uint8_t bits = bitmap[row];
-        for (int col = 0; col < CHAR_WIDTH; ++col) {
-            if (bits & (1u << (7 - col))) {
-                set_pixel(px + col, py + row, fg_r, fg_g, fg_b);
-            } else {
-                set_pixel(px + col, py + row, bg_r, bg_g, bg_b);
-            }
+    check_format();
+
+    const fb_ops_t *ops = fb_ops;
+    unsigned int bytes = ops->bytes;
+    if (!bytes) return;
+
+    size_t pitch = vesa_mode_info.BytesPerScanLine;
+    uint8_t *dst = fb_target() + (size_t)py * pitch + (size_t)px * bytes;
+    cell_t attrs = cells[0];
+    glyph_row_t *rows = glyph_table(CELL_FG(attrs), CELL_BG(attrs));
+    for (int i = 0; i < n; ++i, dst += CHAR_WIDTH * bytes) {
+        cell_t cell = cells[i];
+        if ((cell ^ attrs) >> 16) {
+            attrs = cell;
+            rows = glyph_table(CELL_FG(cell), CELL_BG(cell));
         }
+        ops->glyph(dst, pitch, glyph_bitmap(CELL_GLYPH(cell)), rows);
     }
+    fb_damage(px, py, n * CHAR_WIDTH, CHAR_HEIGHT);
 }
 
-/* Draw one character at grid coordinates (accepts codepoint index) */
-void draw_char_cell(int cx, int cy, uint16_t code) {
-    update_max();
-    if (cx < 0 || cy < 0 || cx >= max_cols || cy >= max_rows) return;
-    /* store in buffer */
-    screen_buffer[cy * max_cols + cx] = code;
-    draw_glyph_at_cell(code, cx, cy);
+/* history row i, 0 = oldest */
+static inline cell_t *history_row(int i) {
+    int r = hist_head - hist_count + i;
+    if (r < 0) r += hist_lines;
+    return history + (size_t)r * hist_cols;
+}
+
+static void scrollback_push(const cell_t *row) {
+    if (!history) return;
+    if (hist_cols != max_cols) {
+        hist_cols = max_cols;
+        hist_lines = (int)(history_cells / (size_t)max_cols);
+        hist_head = hist_count = 0;
+        view_offset = 0;
+    }
+    if (!hist_lines) return;
+    memcpy(history + (size_t)hist_head * hist_cols, row, (size_t)hist_cols * sizeof(cell_t));
+    if (++hist_head == hist_lines) hist_head = 0;
+    if (hist_count < hist_lines) hist_count++;
 }
 
-/* Redraw entire screen from buffer */
+/* Redraw entire screen from buffer (or the part of history in view) */
 void redraw_from_buffer(void) {
     update_max();
-    clear_screen(bg_r, bg_g, bg_b);
+    /* every cell gets painted below, only the strips right of and below
+       the grid need clearing */
+    int grid_w = max_cols * CHAR_WIDTH, grid_h = max_rows * CHAR_HEIGHT;
+    const uint8_t *bg = palette_rgb[cur_bg];
+    rectangle(grid_w, 0, vesa_mode_info.XResolution - grid_w, vesa_mode_info.YResolution, bg[0], bg[1], bg[2]);
+    rectangle(0, grid_h, grid_w, vesa_mode_info.YResolution - grid_h, bg[0], bg[1], bg[2]);
+    if (hist_cols != max_cols) view_offset = 0;
     for (int y = 0; y < max_rows; ++y) {
-        for (int x = 0; x < max_cols; ++x) {
-            uint16_t glyph = screen_buffer[y * max_cols + x];
-            /* treat 0 as space if uninitialized */
-            if (glyph == 0) glyph = (uint16_t)' ';
-            draw_glyph_at_cell(glyph, x, y);
-        }
+        int line = y - view_offset;     /* < 0: history */
+        draw_cells(0, y, line < 0 ? history_row(hist_count + line) : row_cells(line), max_cols);
     }
 }
 
-/* Scroll up one line */
-static void scroll_up(void) {
+/* Move the view pages screens back into history (negative: forward) */
+void scrollback_page(int pages) {
     update_max();
-    size_t row_bytes = (size_t)max_cols * sizeof(screen_buffer[0]);
-    for (int y = 1; y < max_rows; ++y) {
-        memcpy(&screen_buffer[(y - 1) * max_cols],
-               &screen_buffer[y * max_cols],
-               row_bytes);
+    int offset = view_offset + pages * (max_rows > 1 ? max_rows - 1 : 1);
+    if (hist_cols != max_cols || offset < 0) offset = 0;
+    if (offset > hist_count) offset = hist_count;
+    if (offset == view_offset) return;
+    view_offset = offset;
+    redraw_from_buffer();
+}
+
+static inline void live_view(void) {
+    if (view_offset) {
+        view_offset = 0;
+        redraw_from_buffer();
     }
-    /* clear last row */
-    for (int x = 0; x < max_cols; ++x) {
-        screen_buffer[(max_rows - 1) * max_cols + x] = (uint16_t)' ';
+}
+
+/* Draw one character at grid coordinates (accepts codepoint index) */
+void draw_char_cell(int cx, int cy, uint16_t code) {
+    update_max();
+    if (cx < 0 || cy < 0 || cx >= max_cols || cy >= max_rows) return;
+    live_view();
+    cell_t cell = CELL(code, cur_fg, cur_bg);
+    row_cells(cy)[cx] = cell;
+    draw_cells(cx, cy, &cell, 1);
+}
+
+/* blank columns [x0, x1) of row y with the current attributes */
+static void erase_cells(int y, int x0, int x1) {
+    if (x1 > max_cols) x1 = max_cols;
+    if (x0 >= x1) return;
+    cell_t *cells = row_cells(y);
+    for (int x = x0; x < x1; ++x) cells[x] = BLANK_CELL();
+    draw_cells(x0, y, cells + x0, x1 - x0);
+}
+
+static void erase_rows(int y0, int y1) {
+    for (int y = y0; y <= y1; ++y) erase_cells(y, 0, max_cols);
+}
+
+/* ——— Terminal ———
+ * print() and printf() understand the usual VT100/ANSI subset:
+ *   ESC 7 / ESC 8          save / restore cursor and attributes
+ *   ESC D, ESC E, ESC M    index, next line, reverse index
+ *   ESC c                  reset
+ *   CSI n A/B/C/D/E/F      cursor up/down/right/left/next line/previous line
+ *   CSI n G, CSI n d       column, row
+ *   CSI y;x H (or f)       position
+ *   CSI n J, CSI n K       erase in screen, in line (0 to end, 1 to cursor, 2 all)
+ *   CSI n X                erase n characters
+ *   CSI n L, CSI n M       insert, delete lines inside the scroll region
+ *   CSI n S, CSI n T       scroll the region up, down
+ *   CSI t;b r              scroll region
+ *   CSI s, CSI u           save, restore cursor
+ *   CSI ... m              SGR: 0, 1, 22, 7, 27, 30-37, 39, 40-47, 49, 90-97,
+ *                          100-107, 38;5;n / 48;5;n, 38;2;r;g;b / 48;2;r;g;b
+ * Private sequences (CSI ? ...) are parsed and ignored. Other control bytes
+ * than ESC, \n, \r, \b and \t show their glyph, like bytes 32..127 do. The
+ * parser state survives between calls, so a sequence or a two byte glyph can
+ * be split over several print()s.
+ * As on a VT100, writing the last column leaves the cursor there with a wrap
+ * pending, the line feed only happens with the next character.
+ */
+enum { ST_GROUND, ST_ESC, ST_CSI, ST_LEAD };
+#define CSI_MAX_PARAMS 16
+
+static struct {
+    uint8_t state;
+    uint8_t lead;           /* first byte of a two byte glyph */
+    uint8_t priv;           /* CSI with a private marker (?, >, =) */
+    int nparams;
+    int params[CSI_MAX_PARAMS];
+} term;
+
+/* SGR attributes: a colour given as one of the 8 ANSI colours is kept as
+   that, so bold can pick its bright variant */
+typedef struct {
+    uint8_t fg, bg;
+    int8_t fg_ansi;         /* 0..7, -1 when fg is not an ANSI colour */
+    uint8_t bold, reverse;
+} attr_t;
+
+static attr_t attr = { 0, 1, -1, 0, 0 };
+static uint8_t def_fg = 0, def_bg = 1;     /* what SGR 0, 39 and 49 go back to */
+static int scroll_top = 0, scroll_bot = -1;     /* -1: last row */
+
+static struct {
+    int x, y;
+    attr_t attr;
+} saved;
+
+static const uint8_t ansi_rgb[16][3] = {
+    {   0,   0,   0 }, { 170,   0,   0 }, {   0, 170,   0 }, { 170,  85,   0 },
+    {   0,   0, 170 }, { 170,   0, 170 }, {   0, 170, 170 }, { 170, 170, 170 },
+    {  85,  85,  85 }, { 255,  85,  85 }, {  85, 255,  85 }, { 255, 255,  85 },
+    {  85,  85, 255 }, { 255,  85, 255 }, {  85, 255, 255 }, { 255, 255, 255 },
+};
+
+/* palette index for xterm colour n: 16 ANSI colours, 6x6x6 cube, 24 greys */
+static uint8_t ansi_color(int n) {
+    static const uint8_t level[6] = { 0, 95, 135, 175, 215, 255 };
+    if (n < 16) return palette_index(ansi_rgb[n][0], ansi_rgb[n][1], ansi_rgb[n][2]);
+    if (n < 232) {
+        n -= 16;
+        return palette_index(level[n / 36], level[n / 6 % 6], level[n % 6]);
     }
-    redraw_from_buffer();
-    cursor_y = max_rows - 1;
-    if (cursor_x >= max_cols) cursor_x = max_cols - 1;
+    uint8_t grey = (uint8_t)(8 + (n - 232) * 10);
+    return palette_index(grey, grey, grey);
+}
+
+static void apply_attr(void) {
+    uint8_t fg = attr.fg_ansi >= 0 ? ansi_color(attr.fg_ansi + (attr.bold ? 8 : 0)) : attr.fg;
+    cur_fg = attr.reverse ? attr.bg : fg;
+    cur_bg = attr.reverse ? fg : attr.bg;
+}
+
+/* scroll region, the whole screen unless one is set and fits the mode */
+static inline int region_valid(void) {
+    return scroll_bot > scroll_top && scroll_bot < max_rows;
+}
+static inline int region_top(void) { return region_valid() ? scroll_top : 0; }
+static inline int region_bot(void) { return region_valid() ? scroll_bot : max_rows - 1; }
+
+/* move rows top..bot up by n, blank rows come in at the bottom. Scrolling
+   the whole screen rotates the ring instead of copying cells; either way
+   the pixels move in one go and only the new rows get drawn */
+static void scroll_rows_up(int top, int bot, int n) {
+    if (n > bot - top + 1) n = bot - top + 1;
+    if (n <= 0) return;
+    if (top == 0) {
+        for (int y = 0; y < n; ++y) scrollback_push(row_cells(y));
+    }
+    if (top == 0 && bot == max_rows - 1) {
+        top_row = (top_row + n) % max_rows;
+    } else {
+        for (int y = top; y + n <= bot; ++y)
+            memcpy(row_cells(y), row_cells(y + n), (size_t)max_cols * sizeof(cell_t));
+    }
+    vesa_move_rows(top * CHAR_HEIGHT, (top + n) * CHAR_HEIGHT, (bot - top + 1 - n) * CHAR_HEIGHT);
+    erase_rows(bot - n + 1, bot);
+}
+
+static void scroll_rows_down(int top, int bot, int n) {
+    if (n > bot - top + 1) n = bot - top + 1;
+    if (n <= 0) return;
+    if (top == 0 && bot == max_rows - 1) {
+        top_row = (top_row + max_rows - n) % max_rows;
+    } else {
+        for (int y = bot; y - n >= top; --y)
+            memcpy(row_cells(y), row_cells(y - n), (size_t)max_cols * sizeof(cell_t));
+    }
+    vesa_move_rows((top + n) * CHAR_HEIGHT, top * CHAR_HEIGHT, (bot - top + 1 - n) * CHAR_HEIGHT);
+    erase_rows(top, top + n - 1);
+}
+
+/* cursor down a row, scrolling the region when on its last row */
+static void line_feed(void) {
+    if (cursor_y == region_bot()) scroll_rows_up(region_top(), region_bot(), 1);
+    else if (cursor_y < max_rows - 1) cursor_y++;
+}
+
+static void reverse_line_feed(void) {
+    if (cursor_y == region_top()) scroll_rows_down(region_top(), region_bot(), 1);
+    else if (cursor_y > 0) cursor_y--;
 }
 
 /* Handle newline and scrolling */
 static void newline_advance(void) {
     cursor_x = 0;
-    cursor_y++;
-    if (cursor_y >= max_rows) {
-        scroll_up();
-    }
+    line_feed();
 }
 
-/* Helper: decode the custom 1/2-byte encoding from a byte stream.
-   - s points to the current byte. This function consumes bytes via *s_ptr.
-   - Returns glyph index and advances (*s_ptr) appropriately.
-*/
-static uint16_t decode_glyph_from_bytes(const char **s_ptr) {
-    const unsigned char *s = (const unsigned char *)(*s_ptr);
-    if (!s || *s == 0) return (uint16_t)'?';
-    unsigned char b1 = *s++;
-    if (b1 < SINGLE_BYTE_LIMIT) {
-        *s_ptr = (const char *)s;
-        return (uint16_t)b1;
-    } else {
-        /* Need a second byte. If missing, return '?' and do not overrun */
-        unsigned char b2 = 0;
-        if (*s) {
-            b2 = *s++;
-            *s_ptr = (const char *)s;
-        } else {
-            /* malformed: missing second byte -> fallback to '?' and do not advance further */
-            *s_ptr = (const char *)s;
-            return (uint16_t)'?';
+static void put_glyph(uint16_t glyph) {
+    if (cursor_x >= max_cols) newline_advance();
+    cell_t cell = CELL(glyph, cur_fg, cur_bg);
+    row_cells(cursor_y)[cursor_x] = cell;
+    draw_cells(cursor_x++, cursor_y, &cell, 1);
+}
+
+static void move_cursor(int x, int y) {
+    cursor_x = x < 0 ? 0 : x >= max_cols ? max_cols - 1 : x;
+    cursor_y = y < 0 ? 0 : y >= max_rows ? max_rows - 1 : y;
+}
+
+/* CSI parameter i, def when missing or 0 */
+static inline int csi_param(int i, int def) {
+    return (i < term.nparams && term.params[i] > 0) ? term.params[i] : def;
+}
+
+static void sgr(void) {
+    int n = term.nparams ? term.nparams : 1;
+    for (int i = 0; i < n; ++i) {
+        int p = i < term.nparams ? term.params[i] : 0;
+        if (p == 0) {
+            attr = (attr_t){ def_fg, def_bg, -1, 0, 0 };
+        } else if (p == 1) {
+            attr.bold = 1;
+        } else if (p == 22) {
+            attr.bold = 0;
+        } else if (p == 7) {
+            attr.reverse = 1;
+        } else if (p == 27) {
+            attr.reverse = 0;
+        } else if (p >= 30 && p <= 37) {
+            attr.fg_ansi = (int8_t)(p - 30);
+        } else if (p >= 90 && p <= 97) {
+            attr.fg = ansi_color(p - 90 + 8);
+            attr.fg_ansi = -1;
+        } else if (p == 39) {
+            attr.fg = def_fg;
+            attr.fg_ansi = -1;
+        } else if (p >= 40 && p <= 47) {
+            attr.bg = ansi_color(p - 40);
+        } else if (p >= 100 && p <= 107) {
+            attr.bg = ansi_color(p - 100 + 8);
+        } else if (p == 49) {
+            attr.bg = def_bg;
+        } else if ((p == 38 || p == 48) && i + 1 < n) {
+            /* 38;5;n or 38;2;r;g;b, the same with 48 for the background */
+            int color;
+            if (term.params[i + 1] == 5 && i + 2 < n) {
+                color = ansi_color(term.params[i + 2] & 0xFF);
+                i += 2;
+            } else if (term.params[i + 1] == 2 && i + 4 < n) {
+                color = palette_index((uint8_t)term.params[i + 2], (uint8_t)term.params[i + 3],
+                                      (uint8_t)term.params[i + 4]);
+                i += 4;
+            } else {
+                break;
+            }
+            if (p == 38) {
+                attr.fg = (uint8_t)color;
+                attr.fg_ansi = -1;
+            } else {
+                attr.bg = (uint8_t)color;
+            }
         }
-        uint32_t index = SINGLE_BYTE_LIMIT + ((uint32_t)(b1 - SINGLE_BYTE_LIMIT) * EXT_BLOCK_WIDTH) + (uint32_t)b2;
-        if (index >= NUM_GLYPHS) return (uint16_t)'?';
-        return (uint16_t)index;
     }
+    apply_attr();
 }
 
-void print(const char *s) {
-    if (!s) return;
+static void csi_dispatch(unsigned char final) {
+    if (term.priv) return;
+    int n = csi_param(0, 1);
+    int x = cursor_x < max_cols ? cursor_x : max_cols - 1;
+
+    switch (final) {
+        case 'A': move_cursor(x, cursor_y - n); break;
+        case 'B': move_cursor(x, cursor_y + n); break;
+        case 'C': move_cursor(x + n, cursor_y); break;
+        case 'D': move_cursor(x - n, cursor_y); break;
+        case 'E': move_cursor(0, cursor_y + n); break;
+        case 'F': move_cursor(0, cursor_y - n); break;
+        case 'G': move_cursor(n - 1, cursor_y); break;
+        case 'd': move_cursor(x, n - 1); break;
+        case 'H':
+        case 'f': move_cursor(csi_param(1, 1) - 1, n - 1); break;
+        case 'J':
+            switch (csi_param(0, 0)) {
+                case 0:
+                    erase_cells(cursor_y, x, max_cols);
+                    erase_rows(cursor_y + 1, max_rows - 1);
+                    break;
+                case 1:
+                    erase_rows(0, cursor_y - 1);
+                    erase_cells(cursor_y, 0, x + 1);
+                    break;
+                default:
+                    erase_rows(0, max_rows - 1);
+                    break;
+            }
+            break;
+        case 'K':
+            switch (csi_param(0, 0)) {
+                case 0: erase_cells(cursor_y, x, max_cols); break;
+                case 1: erase_cells(cursor_y, 0, x + 1); break;
+                default: erase_cells(cursor_y, 0, max_cols); break;
+            }
+            break;
+        case 'X': erase_cells(cursor_y, x, x + n); break;
+        case 'L':
+        case 'M':
+            if (cursor_y < region_top() || cursor_y > region_bot()) break;
+            if (final == 'L') scroll_rows_down(cursor_y, region_bot(), n);
+            else scroll_rows_up(cursor_y, region_bot(), n);
+            cursor_x = 0;
+            break;
+        case 'S': scroll_rows_up(region_top(), region_bot(), n); break;
+        case 'T': scroll_rows_down(region_top(), region_bot(), n); break;
+        case 'r':
+            scroll_top = csi_param(0, 1) - 1;
+            scroll_bot = csi_param(1, max_rows) - 1;
+            move_cursor(0, 0);
+            break;
+        case 's':
+            saved.x = x;
+            saved.y = cursor_y;
+            saved.attr = attr;
+            break;
+        case 'u':
+            attr = saved.attr;
+            apply_attr();
+            move_cursor(saved.x, saved.y);
+            break;
+        case 'm': sgr(); break;
+    }
+}
+
+static void esc_dispatch(unsigned char c) {
+    term.state = ST_GROUND;
+    switch (c) {
+        case '[':
+            term.state = ST_CSI;
+            term.priv = 0;
+            term.nparams = 0;
+            term.params[0] = 0;
+            break;
+        case '7': csi_dispatch('s'); break;
+        case '8': csi_dispatch('u'); break;
+        case 'D': line_feed(); break;
+        case 'E': newline_advance(); break;
+        case 'M': reverse_line_feed(); break;
+        case 'c':
+            attr = (attr_t){ def_fg, def_bg, -1, 0, 0 };
+            apply_attr();
+            scroll_top = 0;
+            scroll_bot = -1;
+            clear_screen_text();
+            break;
+    }
+}
+
+static void csi_byte(unsigned char c) {
+    if (c >= '0' && c <= '9') {
+        if (!term.nparams) term.nparams = 1;
+        int *p = &term.params[term.nparams - 1];
+        if (*p < 10000) *p = *p * 10 + (c - '0');
+    } else if (c == ';') {
+        if (!term.nparams) term.nparams = 1;
+        if (term.nparams < CSI_MAX_PARAMS) term.params[term.nparams++] = 0;
+    } else if (c >= '<' && c <= '?') {
+        term.priv = 1;
+    } else if (c >= 0x40 && c <= 0x7E) {
+        term.state = ST_GROUND;
+        csi_dispatch(c);
+    } else if (c == 0x1B) {
+        term.state = ST_ESC;
+    } else if (c == 0x18 || c == 0x1A) {
+        term.state = ST_GROUND;     /* CAN, SUB abort the sequence */
+    }
+    /* intermediates and other control bytes are ignored */
+}
+
+static inline int is_plain(unsigned char c) {
+    return c >= ' ' && c < 0x7F;
+}
+
+/* Put n bytes on the console. Runs of printable ASCII are the fast path:
+   as much of the run as fits the row is stored and drawn in one go, with
+   one damage rect. Everything else goes through the escape parser */
+static void console_write(const char *s, size_t n) {
+    const unsigned char *p = (const unsigned char *)s, *end = p + n;
     update_max();
-    while (*s) {
-        if (*s == '\n') {
-            newline_advance();
-            s++;
+    live_view();
+    if (cursor_y >= max_rows) cursor_y = max_rows - 1;
+    if (cursor_x > max_cols) cursor_x = max_cols;
+
+    while (p < end) {
+        if (term.state == ST_GROUND && is_plain(*p)) {
+            if (cursor_x >= max_cols) newline_advance();
+            const unsigned char *run = p;
+            const unsigned char *stop = (size_t)(end - p) > (size_t)(max_cols - cursor_x) ? p + (max_cols - cursor_x) : end;
+            while (p < stop && is_plain(*p)) p++;
+
+            int len = (int)(p - run);
+            cell_t *cells = row_cells(cursor_y) + cursor_x;
+            for (int i = 0; i < len; ++i) cells[i] = CELL(run[i], cur_fg, cur_bg);
+            draw_cells(cursor_x, cursor_y, cells, len);
+            cursor_x += len;
             continue;
-        } else if (*s == '\r') {
+        }
+
+        unsigned char c = *p++;
+        switch (term.state) {
+            case ST_ESC:
+                esc_dispatch(c);
+                continue;
+            case ST_CSI:
+                csi_byte(c);
+                continue;
+            case ST_LEAD: {
+                uint32_t index = SINGLE_BYTE_LIMIT + (uint32_t)(term.lead - SINGLE_BYTE_LIMIT) * EXT_BLOCK_WIDTH + c;
+                term.state = ST_GROUND;
+                put_glyph(index < NUM_GLYPHS ? (uint16_t)index : (uint16_t)'?');
+                continue;
+            }
+        }
+
+        if (c == 0x1B) {
+            term.state = ST_ESC;
+        } else if (c == '\n') {
+            newline_advance();
+        } else if (c == '\r') {
             cursor_x = 0;
-            s++;
-            continue;
-        } else if (*s == '\b') {
+        } else if (c == '\b') {
+            /* the shell relies on backspace erasing, unlike a VT100 */
             if (cursor_x > 0) {
                 cursor_x--;
             } else if (cursor_y > 0) {
                 cursor_y--;
                 cursor_x = max_cols - 1;
             }
-            draw_char_cell(cursor_x, cursor_y, (uint16_t)' ');
-            s++;
-            continue;
-        } else if (*s == '/') { // handle escape sequences
-            s++;
-            if (*s == '0') { // null byte
-                draw_char_cell(cursor_x, cursor_y, 0);
-                cursor_x++;
-                s++;
-                continue;
-            } else if (*s == '%') { // \%d
-                s++;
-                if (*s == 'd') {
-                    s++;
-                    if (*s >= '0' && *s <= '9') {
-                        uint8_t val = *s - '0';
-                        draw_char_cell(cursor_x, cursor_y, val);
-                        cursor_x++;
-                        s++;
-                    }
-                    continue;
-                }
-            } else if (*s == '\\') { // literal backslash
-                draw_char_cell(cursor_x, cursor_y, '\\');
-                cursor_x++;
-                s++;
-                continue;
-            }
+            erase_cells(cursor_y, cursor_x, cursor_x + 1);
+        } else if (c == '\t') {
+            if (cursor_x < max_cols) move_cursor((cursor_x / 8 + 1) * 8, cursor_y);
+        } else if (c >= SINGLE_BYTE_LIMIT) {
+            term.lead = c;
+            term.state = ST_LEAD;
+        } else {
+            put_glyph(c);
         }
-
-        uint16_t glyph = decode_glyph_from_bytes(&s);
-        draw_char_cell(cursor_x, cursor_y, glyph);
-        cursor_x++;
-        if (cursor_x >= max_cols) newline_advance();
     }
 }
 
+void print_n(const char *s, size_t n) {
+    if (s) console_write(s, n);
+}
+
+void print(const char *s) {
+    if (s) console_write(s, strlen(s));
+}
+
 /* Helper to set a glyph */
 void set_glyph(uint32_t glyph_index, const uint8_t glyph[16]) {
-    if (!font) return;
+    if (!font_blocks[0]) return;
     if (glyph_index >= NUM_GLYPHS) return;
-    memcpy(font[glyph_index], glyph, GLYPH_BYTES);
+
+    uint32_t b = glyph_index >> FONT_BLOCK_SHIFT;
+    if (font_blocks[b] == fallback_block) {
+        uint8_t (*block)[GLYPH_BYTES] = malloc(sizeof(fallback_block));
+        if (!block) return;
+        memcpy(block, fallback_block, sizeof(fallback_block));
+        font_blocks[b] = block;
+    }
+    memcpy(font_blocks[b][glyph_index & (FONT_BLOCK_GLYPHS - 1)], glyph, GLYPH_BYTES);
 }
 
-/* Initialize font: allocate, zero, copy base_font and fill rest with '?' */
+/* Initialize font: block 0 is base_font, the rest share the '?' block */
 void init_font(void) {
-    /* allocate */
-    font = malloc((size_t)NUM_GLYPHS * GLYPH_BYTES);
-    if (!font) {
-        printf("init_font: malloc failed\n");
-        return;
+    const uint8_t *qglyph = base_font[(unsigned char)'?'];
+    for (uint32_t i = 0; i < FONT_BLOCK_GLYPHS; ++i) {
+        memcpy(fallback_block[i], qglyph, GLYPH_BYTES);
     }
 
-    /* zero everything (makes undefined glyphs blank until we set '?') */
-    memset(font, 0, (size_t)NUM_GLYPHS * GLYPH_BYTES);
-
-    /* copy base 256 glyphs at start */
-    memcpy(font, base_font, 256 * GLYPH_BYTES);
-
-    /* determine index of '?' within base_font */
-    unsigned char qidx = (unsigned char)'?';
-    const uint8_t *qglyph = base_font[qidx];
-
-    /* fill extended glyphs with '?' glyph */
-    for (uint32_t i = 256; i < NUM_GLYPHS; ++i) {
-        memcpy(font[i], qglyph, GLYPH_BYTES);
+    font_blocks[0] = base_font;
+    for (uint32_t b = 1; b < FONT_BLOCKS; ++b) {
+        font_blocks[b] = fallback_block;
     }
 }
 
 /* Clear screen text (buffer + framebuffer) */
 void clear_screen_text(void) {
     update_max();
-    clear_screen(bg_r, bg_g, bg_b);
+    clear_screen(palette_rgb[cur_bg][0], palette_rgb[cur_bg][1], palette_rgb[cur_bg][2]);
+    top_row = 0;
     for (int y = 0; y < max_rows; ++y) {
         for (int x = 0; x < max_cols; ++x) {
-            screen_buffer[y * max_cols + x] = (uint16_t)' ';
+            screen_buffer[y * max_cols + x] = BLANK_CELL();
         }
     }
     cursor_x = 0;
     cursor_y = 0;
 }
 
-/* Set text/background color */
+/* Set text/background color for what gets printed from now on, also what
+   SGR 0 goes back to */
 void set_text_color(uint8_t fr, uint8_t fg, uint8_t fb,
                     uint8_t br, uint8_t bg, uint8_t bb) {
-    fg_r = fr; fg_g = fg; fg_b = fb;
-    bg_r = br; bg_g = bg; bg_b = bb;
-    redraw_from_buffer();
+    def_fg = palette_index(fr, fg, fb);
+    def_bg = palette_index(br, bg, bb);
+    attr = (attr_t){ def_fg, def_bg, -1, 0, 0 };
+    apply_attr();
 }
 
 /* Initialize text subsystem - call this once after VESA is ready */
 void text_init(void) {
     clear_screen_text();
     update_max();
+    if (!history) {
+        history_cells = (size_t)SCROLLBACK_LINES * (size_t)max_cols;
+        history = malloc(history_cells * sizeof(cell_t));
+        if (!history) history_cells = 0;
+    }
     /* fill buffer with spaces */
-    for (int i = 0; i < MAX_ROWS * MAX_COLS; ++i) screen_buffer[i] = (uint16_t)' ';
-    clear_screen(bg_r, bg_g, bg_b);
+    for (int i = 0; i < MAX_ROWS * MAX_COLS; ++i) screen_buffer[i] = BLANK_CELL();
+    top_row = 0;
     redraw_from_buffer();
 }
 
-/* ---------------- number -> string helpers ---------------- */
+/* ---------------- formatting core ----------------
+ * The formatter writes into an out_t: a buffer and what to do when it
+ * fills. vsnprintf's is the caller's buffer and only counts what does not
+ * fit, printf's is a buffer on the stack that goes to the console sinks one
+ * run at a time instead of one character at a time.
+ */
+typedef struct {
+    char *buf;
+    size_t size;        /* capacity of buf */
+    size_t pos;         /* bytes in buf */
+    size_t total;       /* bytes produced, whether they fit or not */
+    int level;          /* passed on to flush */
+    void (*flush)(int level, const char *s, size_t n);  /* NULL: drop the overflow */
+} out_t;
 
-/* convert unsigned long (32-bit) to string (no padding), returns length */
-static int ulltoa(unsigned long v, unsigned int base, int uppercase, char *out, size_t out_sz) {
-    const char *digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
-    char tmp[65]; // safe for up to 64-bit
-    int pos = 0;
-
-    if (v == 0) {
-        if (out_sz > 1) { out[0] = '0'; out[1] = '\0'; return 1; }
-        return 0;
-    }
-
-    while (v && pos < (int)sizeof(tmp)) {
-        tmp[pos++] = digits[v % base];
-        v /= base;
-    }
-
-    int len = 0;
-    if (pos > 0) {
-        for (int i = pos - 1; i >= 0 && (size_t)len + 1 < out_sz; --i) {
-            out[len++] = tmp[i];
+static void out_write(out_t *k, const char *s, size_t n) {
+    k->total += n;
+    while (n) {
+        if (k->pos == k->size) {
+            if (!k->flush) return;
+            k->flush(k->level, k->buf, k->pos);
+            k->pos = 0;
         }
+        size_t c = k->size - k->pos;
+        if (c > n) c = n;
+        memcpy(k->buf + k->pos, s, c);
+        k->pos += c;
+        s += c;
+        n -= c;
     }
-
-    if (out_sz > 0) out[len < (int)out_sz ? len : out_sz - 1] = '\0';
-    return len;
 }
 
-/* convert signed long to string, returns length */
-static int slltoa(long v, int base, char *out, size_t out_sz) {
-    if (v < 0) {
-        if (out_sz < 2) return 0;
-        out[0] = '-';
-        int l = ulltoa((unsigned long)(-v), (unsigned)base, 0, out + 1, out_sz > 1 ? out_sz - 1 : 0);
-        return 1 + l;
-    } else {
-        return ulltoa((unsigned long)v, (unsigned)base, 0, out, out_sz);
-    }
+static void out_fill(out_t *k, char c, int n) {
+    char run[16];
+    memset(run, c, sizeof(run));
+    for (; n > 0; n -= (int)sizeof(run))
+        out_write(k, run, n < (int)sizeof(run) ? (size_t)n : sizeof(run));
 }
 
-/* Print a formatted buffer with padding and flags */
-static void emit_padded(const char *buf, int blen, int width, char pad, int left) {
-    if (width <= blen) {
-        print(buf);
-        return;
+#define NUMBUF_LEN 64   /* %llb of ~0 */
+
+/* digits of v in base (2..16) just before end (room for NUMBUF_LEN),
+   returns the start. 64 bit values are divided 16 bits at a time, no
+   libgcc here */
+static char *utoa_rev(unsigned long long v, unsigned int base, int uppercase, char *end) {
+    const char *digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *p = end;
+    if (!(v >> 32)) {
+        uint32_t w = (uint32_t)v;
+        do { *--p = digits[w % base]; w /= base; } while (w);
+        return p;
     }
-    int padcnt = width - blen;
-    if (!left) {
-        for (int i = 0; i < padcnt; ++i) {
-            char p[2] = {pad, 0};
-            print(p);
+    uint32_t limb[4] = { (uint32_t)(v >> 48), (uint32_t)(v >> 32) & 0xFFFF,
+                         (uint32_t)(v >> 16) & 0xFFFF, (uint32_t)v & 0xFFFF };
+    int nonzero;
+    do {
+        uint32_t r = 0;
+        nonzero = 0;
+        for (int i = 0; i < 4; ++i) {
+            uint32_t cur = r << 16 | limb[i];
+            limb[i] = cur / base;
+            r = cur % base;
+            nonzero |= limb[i];
         }
-        print(buf);
-    } else {
-        print(buf);
-        for (int i = 0; i < padcnt; ++i) {
-            char p[2] = {' ', 0};
-            print(p);
-        }
-    }
+        *--p = digits[r];
+    } while (nonzero);
+    return p;
 }
 
-/* ---------------- vprintf implementation ---------------- */
-
-static int vprintf_internal(const char *fmt, va_list ap) {
-    int written = 0;
-    char tmpbuf[256];
+static int format(out_t *k, const char *fmt, va_list ap) {
+    char numbuf[NUMBUF_LEN];
+    char *const numend = numbuf + sizeof(numbuf);
 
     while (*fmt) {
         if (*fmt != '%') {
-            char c[2] = {*fmt, 0};
-            print(c);
-            written++;
-            fmt++;
+            const char *run = fmt;
+            while (*fmt && *fmt != '%') fmt++;
+            out_write(k, run, (size_t)(fmt - run));
             continue;
         }
         fmt++; /* skip '%' */
 
         /* parse flags */
-        int left = 0;
-        int plus = 0; (void)plus;
-        int space_flag = 0; (void)space_flag;
-        int zero = 0;
-        int alt = 0;
-        while (*fmt == '-' || *fmt == '+' || *fmt == ' ' || *fmt == '0' || *fmt == '#') {
+        int left = 0, plus = 0, space = 0, zero = 0, alt = 0;
+        for (;; fmt++) {
             if (*fmt == '-') left = 1;
+            else if (*fmt == '+') plus = 1;
+            else if (*fmt == ' ') space = 1;
             else if (*fmt == '0') zero = 1;
             else if (*fmt == '#') alt = 1;
-            fmt++;
+            else break;
         }
 
-        /* width */
-        int width = 0;
-        while (*fmt >= '0' && *fmt <= '9') {
-            width = width * 10 + (*fmt - '0');
+        /* width, precision */
+        int width = 0, prec = -1;
+        if (*fmt == '*') {
+            width = va_arg(ap, int);
+            if (width < 0) { left = 1; width = -width; }
+            fmt++;
+        }
+        while (*fmt >= '0' && *fmt <= '9') width = width * 10 + (*fmt++ - '0');
+        if (*fmt == '.') {
             fmt++;
+            prec = 0;
+            if (*fmt == '*') {
+                prec = va_arg(ap, int);
+                fmt++;
+            }
+            while (*fmt >= '0' && *fmt <= '9') prec = prec * 10 + (*fmt++ - '0');
         }
 
         /* length modifiers */
-        int length = 0; /* 0=default, 1=l, 2=ll */
+        int length = 0; /* 0=default, 1=l, 2=ll, 3=z */
         if (*fmt == 'l') {
             fmt++;
             if (*fmt == 'l') { length = 2; fmt++; } else length = 1;
+        } else if (*fmt == 'z') {
+            length = 3;
+            fmt++;
+        } else {
+            while (*fmt == 'h') fmt++;
         }
 
         /* specifier */
-        char spec = *fmt ? *fmt : '\0';
+        char spec = *fmt;
         if (!spec) break;
+        fmt++;
+
+        const char *body;
+        int blen;
+        const char *prefix = "";
+        unsigned long long uv = 0;
+        unsigned int base = 10;
 
         switch (spec) {
-            case 'c': {
-                int ch = va_arg(ap, int);
-                char out[2] = {(char)ch, 0};
-                emit_padded(out, 1, width, zero ? '0' : ' ', left);
-                written += (width > 1) ? width : 1;
-                break;
-            }
-            case 's': {
-                const char *s = va_arg(ap, const char*);
-                if (!s) s = "(null)";
-                int len = (int)strlen(s);
-                emit_padded(s, len, width, ' ', left);
-                written += (width > len) ? width : len;
-                break;
-            }
+            case 'c':
+                numbuf[0] = (char)va_arg(ap, int);
+                body = numbuf;
+                blen = 1;
+                goto emit_text;
+            case 's':
+                body = va_arg(ap, const char*);
+                if (!body) body = "(null)";
+                blen = 0;
+                while (body[blen] && (prec < 0 || blen < prec)) blen++;
+            emit_text:
+                if (!left) out_fill(k, ' ', width - blen);
+                out_write(k, body, (size_t)blen);
+                if (left) out_fill(k, ' ', width - blen);
+                continue;
             case 'd':
             case 'i': {
-                long v;
-                if (length == 2) v = va_arg(ap, long);
+                long long v;
+                if (length == 2) v = va_arg(ap, long long);
                 else if (length == 1) v = va_arg(ap, long);
+                else if (length == 3) v = (long long)va_arg(ap, size_t);
                 else v = va_arg(ap, int);
-                int len = slltoa(v, 10, tmpbuf, sizeof(tmpbuf));
-                emit_padded(tmpbuf, len, width, zero ? '0' : ' ', left);
-                written += (width > len) ? width : len;
+                if (v < 0) { prefix = "-"; uv = 0 - (unsigned long long)v; }
+                else { prefix = plus ? "+" : space ? " " : ""; uv = (unsigned long long)v; }
                 break;
             }
-            case 'u': {
-                unsigned long uv;
-                if (length == 2) uv = va_arg(ap, unsigned long);
-                else if (length == 1) uv = va_arg(ap, unsigned long);
-                else uv = va_arg(ap, unsigned int);
-                int len = (int)ulltoa(uv, 10, 0, tmpbuf, sizeof(tmpbuf));
-                emit_padded(tmpbuf, len, width, zero ? '0' : ' ', left);
-                written += (width > len) ? width : len;
+            case 'p':
+                uv = (uintptr_t)va_arg(ap, void*);
+                base = 16;
+                prefix = "0x";
                 break;
-            }
+            case 'u':
             case 'x':
-            case 'X': {
-                unsigned long uv;
-                if (length == 2) uv = va_arg(ap, unsigned long);
+            case 'X':
+            case 'o':
+            case 'b':
+                if (length == 2) uv = va_arg(ap, unsigned long long);
                 else if (length == 1) uv = va_arg(ap, unsigned long);
+                else if (length == 3) uv = va_arg(ap, size_t);
                 else uv = va_arg(ap, unsigned int);
-                int uppercase = (spec == 'X');
-                int len = (int)ulltoa(uv, 16, uppercase, tmpbuf, sizeof(tmpbuf));
-                if (alt && uv != 0) {
-                    if (!zero) {
-                        if (uppercase) print("0X"); else print("0x");
-                        written += 2;
-                        emit_padded(tmpbuf, len, width - 2, zero ? '0' : ' ', left);
-                        written += (width > len + 2) ? width - 2 : len;
-                    } else {
-                        if (uppercase) print("0X"); else print("0x");
-                        written += 2;
-                        for (int i = 0; i < width - len - 2; ++i) { char z[2] = {'0',0}; print(z); written++; }
-                        print(tmpbuf); written += len;
-                    }
-                } else {
-                    emit_padded(tmpbuf, len, width, zero ? '0' : ' ', left);
-                    written += (width > len) ? width : len;
-                }
+                base = spec == 'u' ? 10 : spec == 'o' ? 8 : spec == 'b' ? 2 : 16;
+                if (alt && uv && base == 16) prefix = spec == 'X' ? "0X" : "0x";
+                if (alt && uv && base == 2) prefix = "0b";
                 break;
-            }
-            case 'p': {
-                void *ptr = va_arg(ap, void*);
-                unsigned long uv = (unsigned long)(uintptr_t)ptr;
-                int len = (int)ulltoa(uv, 16, 0, tmpbuf, sizeof(tmpbuf));
-                if (zero && width > 0) {
-                    print("0x"); written += 2;
-                    for (int i = 0; i < width - 2 - len; ++i) { char z[2] = {'0',0}; print(z); written++; }
-                    print(tmpbuf); written += len;
-                } else {
-                    char out_with_prefix[130];
-                    int plen = 0;
-                    out_with_prefix[plen++] = '0';
-                    out_with_prefix[plen++] = 'x';
-                    for (int i = 0; i < len && plen + 1 < (int)sizeof(out_with_prefix); ++i) {
-                        out_with_prefix[plen++] = tmpbuf[i];
-                    }
-                    out_with_prefix[plen] = '\0';
-                    emit_padded(out_with_prefix, plen, width, ' ', left);
-                    written += (width > plen) ? width : plen;
-                }
-                break;
-            }
-            case '%': {
-                print("%"); written++; break;
-            }
+            case '%':
+                out_write(k, "%", 1);
+                continue;
             default: {
-                char out[3] = {'%', spec, 0};
-                print(out);
-                written += 2;
-                break;
+                /* unknown conversion, shown as written */
+                char out[2] = {'%', spec};
+                out_write(k, out, 2);
+                continue;
             }
-        } /* switch */
+        }
 
-        fmt++; /* move past specifier */
-    } /* while fmt */
+        /* numbers: [pad][prefix][zeros][digits] or [prefix][digits][pad] */
+        body = utoa_rev(uv, base, spec == 'X', numend);
+        blen = (int)(numend - body);
+        if (prec == 0 && uv == 0) blen = 0;
+        int plen = (int)strlen(prefix);
+        int zeros = prec > blen ? prec - blen : 0;
+        if (alt && spec == 'o' && !zeros && !(uv == 0 && blen)) zeros = 1;   /* leading 0 */
+        if (zero && !left && prec < 0 && width > plen + blen) zeros = width - plen - blen;
+        int pad = width - plen - zeros - blen;
 
-    return written;
+        if (!left) out_fill(k, ' ', pad);
+        out_write(k, prefix, (size_t)plen);
+        out_fill(k, '0', zeros);
+        out_write(k, body, (size_t)blen);
+        if (left) out_fill(k, ' ', pad);
+    }
+
+    return (int)k->total;
+}
+
+/* ---------------- console sinks ---------------- */
+
+static console_sink_t fb_sink = { "fb", console_write, LOG_DEBUG, NULL };
+static console_sink_t *sinks = &fb_sink;
+
+void console_register(console_sink_t *sink) {
+    console_sink_t **p = &sinks;
+    while (*p) p = &(*p)->next;
+    sink->next = NULL;
+    *p = sink;
+}
+
+console_sink_t *console_find(const char *name) {
+    for (console_sink_t *k = sinks; k; k = k->next) {
+        if (!strcmp(k->name, name)) return k;
+    }
+    return NULL;
+}
+
+static void console_emit(int level, const char *s, size_t n) {
+    for (console_sink_t *k = sinks; k; k = k->next) {
+        if (level <= k->level) k->write(s, n);
+    }
+}
+
+void console_info(void) {
+    static const char *names[] = { "err", "warn", "info", "debug" };
+    for (console_sink_t *k = sinks; k; k = k->next) {
+        printf("  %-8s %d (%s)\n", k->name, k->level,
+               k->level >= LOG_ERR && k->level <= LOG_DEBUG ? names[k->level] : "?");
+    }
+}
+
+int vprintk(int level, const char *fmt, va_list ap) {
+    char buf[256];
+    out_t k = { buf, sizeof(buf), 0, 0, level, console_emit };
+    int ret = format(&k, fmt, ap);
+    console_emit(level, buf, k.pos);
+    return ret;
+}
+
+int printk(int level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = vprintk(level, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+/* Format into buf (at most size bytes, always terminated when size > 0),
+   returns the length the whole output would have */
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list ap) {
+    out_t k = { buf, size ? size - 1 : 0, 0, 0, 0, NULL };
+    int ret = format(&k, fmt, ap);
+    if (size) buf[k.pos] = '\0';
+    return ret;
+}
+
+int snprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    return ret;
 }
 
 /* printf / println wrappers */
+int vprintf(const char *fmt, va_list ap) {
+    return vprintk(LOG_INFO, fmt, ap);
+}
+
 int printf(const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    int ret = vprintf_internal(fmt, ap);
+    int ret = vprintk(LOG_INFO, fmt, ap);
     va_end(ap);
     return ret;
 }
@@ -508,9 +1055,9 @@ int printf(const char *fmt, ...) {
 int println(const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    int ret = vprintf_internal(fmt, ap);
+    int ret = vprintk(LOG_INFO, fmt, ap);
     va_end(ap);
-    print("\n");
+    console_emit(LOG_INFO, "\n", 1);
     return ret + 1;
 }
 
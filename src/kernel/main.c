@@ -10,6 +10,14 @@
 #include <ata.h>
 #include <asm.h>
 #include <idt.h>
+#include <slab.h>
+#include <heap.h>
+#include <pmm.h>
+#include <paging.h>
+#include <cpu.h>
+#include <console.h>
+#include <serial.h>
+#include <klog.h>
 
 idt_entry_t idt[256];
 
@@ -100,6 +108,8 @@ extern volatile unsigned char last_key_state;
 
 #define SC_LSHIFT 0x2A
 #define SC_RSHIFT 0x36
+#define SC_PGUP   0x49
+#define SC_PGDN   0x51
 
 static char is_shift_pressed = 0;
 
@@ -113,19 +123,32 @@ void execute_command(const char* line);
 
 // ---------------- Shell main ----------------
 
-void main() {
+void main(const e820_entry_t* mmap, uint32_t mmap_count) {
+    vesa_init();
+    serial_init();
+    cpu_init();
+    pmm_init(mmap, mmap_count);
+    klog_init();
+    paging_init();
+    fb_shadow_init();
+    int vram_rows = fb_pages_init();
+
     set_text_color(255,255,255,0,0,0);
     clear_screen(0,0,0);
     init_font();
     text_init();
 
     printf("[kernel] Booted\n");
-    printf("[kernel] VESA: %ux%u, %u-bit color, %u-byte framebuffer at 0x%08X\n",
-        vesa_mode_info.XResolution, vesa_mode_info.YResolution,
+    printf("[kernel] VESA: mode 0x%03X, %ux%u, %u-bit color, %u-byte framebuffer at 0x%08X\n",
+        vesa_mode_number, vesa_mode_info.XResolution, vesa_mode_info.YResolution,
         vesa_mode_info.BitsPerPixel,
         vesa_mode_info.BytesPerScanLine * vesa_mode_info.YResolution,
         vesa_mode_info.PhysBasePtr
     );
+    if (vram_rows)
+        printf("[kernel] DISPI: %d rows of video memory, page flipping and hardware scroll on\n", vram_rows);
+    printf("[kernel] RAM: %u MB usable, %u MB free\n",
+        (unsigned int)(pmm_total_bytes() >> 20), (unsigned int)(pmm_free_bytes() >> 20));
 
     new_func((function)malloc, "malloc");
     new_func((function)free, "free");
@@ -140,7 +163,11 @@ void main() {
 
     while (1) {
         unsigned char sc = last_scancode;
-        if (sc == prev_scancode) continue;
+        if (sc == prev_scancode) {
+            // idle: print whatever was logged meanwhile
+            klog_drain();
+            continue;
+        }
         prev_scancode = sc;
 
         int released = sc & 0x80;
@@ -153,6 +180,12 @@ void main() {
 
         if (released) continue;
 
+        // Shift+PgUp/PgDn pages through the scrollback
+        if (is_shift_pressed && (key == SC_PGUP || key == SC_PGDN)) {
+            scrollback_page(key == SC_PGUP ? 1 : -1);
+            continue;
+        }
+
         char c;
         if (is_shift_pressed)
             c = current_layout_shift[key];
@@ -222,6 +255,42 @@ void execute_command(const char* line) {
         if (size == 0) size = 16; // default minimal dump
 
         memdump((void*)addr, size);
+    } else if (strcmp(line, "meminfo") == 0) {
+        pmm_info();
+    } else if (strcmp(line, "heapstat") == 0) {
+        heap_print_stats();
+    } else if (strcmp(line, "slabinfo") == 0) {
+        kmem_cache_info();
+    } else if (strcmp(line, "cpuinfo") == 0) {
+        cpu_info();
+    } else if (strncmp(line, "loglevel", 8) == 0 && (!line[8] || line[8] == ' ')) {
+        // loglevel [sink level]: what each console sink lets through
+        char name[16];
+        const char* arg = line + 8;
+        while (*arg == ' ') arg++;
+        size_t n = 0;
+        while (arg[n] && arg[n] != ' ' && n < sizeof(name) - 1) { name[n] = arg[n]; n++; }
+        name[n] = 0;
+        if (n) {
+            console_sink_t* sink = console_find(name);
+            char* end;
+            unsigned long level = strtoul(arg + n, &end, 0);
+            while (*end == ' ') end++;
+            if (!sink) {
+                printf("No console sink %s\n", name);
+            } else if (end == arg + n || *end || level > LOG_DEBUG) {
+                printf("Usage: loglevel [sink %d-%d]\n", LOG_ERR, LOG_DEBUG);
+                return;
+            } else {
+                sink->level = (int)level;
+            }
+        }
+        console_info();
+    } else if (strcmp(line, "dmesg") == 0) {
+        klog_dump();
+    } else if (strcmp(line, "dmesg on") == 0 || strcmp(line, "dmesg off") == 0) {
+        // whether the idle loop prints new log records as they come
+        klog_set_drain(line[7] == 'n');
     } else if (strncmp(line, "poke ", 5) == 0) {
         char *endptr;
         unsigned int addr = strtoul(line + 5, &endptr, 0);
@@ -0,0 +1,186 @@
+// mm/paging.c -- identity paging with 4 MB pages, PAT/MTRR cache control
+//
+// One page directory, no page tables: every entry is a 4 MB PSE page. RAM up
+// to the top of what the page allocator manages is mapped write back; MMIO
+// ranges get mapped on demand with the caching they ask for. Write combining
+// uses a PAT entry when the CPU has PAT, otherwise a variable range MTRR.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <asm.h>
+#include <pmm.h>
+#include <vesa.h>
+#include <paging.h>
+#include <cpu.h>
+#include <cyrillic.h>
+
+#define PDE_PRESENT     0x001u
+#define PDE_RW          0x002u
+#define PDE_PWT         0x008u
+#define PDE_PCD         0x010u
+#define PDE_PS          0x080u
+#define PDE_PAT         0x1000u     /* PAT bit of a 4 MB entry */
+
+#define CR0_PG          0x80000000u
+#define CR0_CD          0x40000000u
+#define CR0_NW          0x20000000u
+#define CR4_PSE         0x00000010u
+
+#define MSR_MTRRCAP         0x0FE
+#define MSR_PAT             0x277
+#define MSR_MTRR_DEF_TYPE   0x2FF
+#define MSR_MTRR_PHYSBASE(n) (0x200 + 2 * (n))
+#define MSR_MTRR_PHYSMASK(n) (0x201 + 2 * (n))
+#define MTRR_ENABLE         0x800u
+#define MTRR_VALID          0x800u
+#define MTRRCAP_WC          0x400u
+
+/* memory types, same encoding for PAT and MTRR */
+#define MT_UC   0x00
+#define MT_WC   0x01
+#define MT_WT   0x04
+#define MT_WB   0x06
+#define MT_UCM  0x07
+
+/* PA0-PA3 keep their power-on meaning (WB, WT, UC-, UC) so PWT/PCD work as
+   they always did, PA4 (PAT bit set) becomes write combining */
+#define PAT_VALUE ((uint64_t)MT_WB        | (uint64_t)MT_WT << 8  | \
+                   (uint64_t)MT_UCM << 16 | (uint64_t)MT_UC << 24 | \
+                   (uint64_t)MT_WC << 32  | (uint64_t)MT_WT << 40 | \
+                   (uint64_t)MT_UCM << 48 | (uint64_t)MT_UC << 56)
+
+static uint32_t page_directory[1024] __attribute__((aligned(4096)));
+static uint32_t ram_pdes = 0;
+static int paging_on = 0;
+static int has_pat = 0;
+static int has_mtrr = 0;
+
+/* grab a free variable range MTRR for [base, base + size), size rounded up
+   to a power of two. Follows the SDM: caches off and flushed while changing */
+static int mtrr_add(uint32_t base, uint32_t size, uint8_t type) {
+    uint32_t a, b, c, d;
+    uint64_t cap = rdmsr(MSR_MTRRCAP);
+    if (type == MT_WC && !(cap & MTRRCAP_WC)) return 0;
+
+    uint32_t range = 0x1000;
+    while (range < size && range < 0x80000000u) range <<= 1;
+    if (base & (range - 1)) return 0;
+
+    int slot = -1;
+    for (int i = 0; i < (int)(cap & 0xFF); i++) {
+        if (!(rdmsr(MSR_MTRR_PHYSMASK(i)) & MTRR_VALID)) { slot = i; break; }
+    }
+    if (slot < 0) return 0;
+
+    uint32_t phys_bits = 36;
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    if (a >= 0x80000008) {
+        cpuid(0x80000008, 0, &a, &b, &c, &d);
+        phys_bits = a & 0xFF;
+    }
+    uint64_t mask = (((uint64_t)1 << phys_bits) - 1) & ~(uint64_t)(range - 1);
+
+    uintptr_t flags = irq_save();
+    uint32_t cr0 = read_cr0();
+    write_cr0((cr0 | CR0_CD) & ~CR0_NW);
+    wbinvd();
+    uint64_t def = rdmsr(MSR_MTRR_DEF_TYPE);
+    wrmsr(MSR_MTRR_DEF_TYPE, def & ~(uint64_t)MTRR_ENABLE);
+
+    wrmsr(MSR_MTRR_PHYSBASE(slot), (uint64_t)base | type);
+    wrmsr(MSR_MTRR_PHYSMASK(slot), mask | MTRR_VALID);
+
+    wbinvd();
+    wrmsr(MSR_MTRR_DEF_TYPE, def);
+    write_cr0(cr0);
+    irq_restore(flags);
+    return 1;
+}
+
+static uint32_t cache_bits(cache_type_t type, uint32_t phys, uint32_t size) {
+    switch (type) {
+        case CACHE_WT: return PDE_PWT;
+        case CACHE_UC: return PDE_PCD | PDE_PWT;
+        case CACHE_WC:
+            if (has_pat) return PDE_PAT;
+            /* PDE stays WB, the MTRR makes the effective type WC */
+            if (has_mtrr && mtrr_add(phys, size, MT_WC)) return 0;
+            DEBUG_PRINT("[paging] no PAT or free MTRR, 0x%08X left uncombined\n", phys);
+            return 0;
+        case CACHE_WB:
+        default:
+            return 0;
+    }
+}
+
+void* mmio_map(uint32_t phys, uint32_t size, cache_type_t type) {
+    if (!size) return NULL;
+    if (!paging_on) return (void*)(uintptr_t)phys;
+
+    uint32_t bits = cache_bits(type, phys, size);
+    uint32_t first = phys / LARGE_PAGE_SIZE;
+    uint32_t last = (phys + (size - 1)) / LARGE_PAGE_SIZE;
+    if (last < first) last = 1023;   /* ran past 4 GB */
+
+    for (uint32_t i = first; i <= last; i++) {
+        page_directory[i] = (i * LARGE_PAGE_SIZE) | PDE_PRESENT | PDE_RW | PDE_PS | bits;
+        invlpg((void*)(uintptr_t)(i * LARGE_PAGE_SIZE));
+    }
+    return (void*)(uintptr_t)phys;
+}
+
+void mmio_unmap(void* addr, uint32_t size) {
+    if (!paging_on || !size) return;
+
+    uint32_t phys = (uint32_t)(uintptr_t)addr;
+    uint32_t first = phys / LARGE_PAGE_SIZE;
+    uint32_t last = (phys + (size - 1)) / LARGE_PAGE_SIZE;
+    if (last < first) last = 1023;
+
+    for (uint32_t i = first; i <= last; i++) {
+        /* MMIO inside the RAM window goes back to plain write back RAM */
+        if (i < ram_pdes)
+            page_directory[i] = (i * LARGE_PAGE_SIZE) | PDE_PRESENT | PDE_RW | PDE_PS;
+        else
+            page_directory[i] = 0;
+        invlpg((void*)(uintptr_t)(i * LARGE_PAGE_SIZE));
+    }
+}
+
+void paging_init(void) {
+    if (!cpu_has(CPU_PSE)) {
+        DEBUG_PRINT("[paging] CPU has no PSE, running unpaged\n");
+        return;
+    }
+    has_pat = cpu_has(CPU_PAT);
+    has_mtrr = cpu_has(CPU_MTRR);
+
+    uintptr_t top = pmm_top();
+    if (top < LARGE_PAGE_SIZE) top = LARGE_PAGE_SIZE;
+    ram_pdes = (uint32_t)((top + LARGE_PAGE_SIZE - 1) / LARGE_PAGE_SIZE);
+
+    for (uint32_t i = 0; i < 1024; i++) {
+        page_directory[i] = (i < ram_pdes)
+            ? (i * LARGE_PAGE_SIZE) | PDE_PRESENT | PDE_RW | PDE_PS
+            : 0;
+    }
+
+    if (has_pat) {
+        uintptr_t flags = irq_save();
+        wbinvd();
+        wrmsr(MSR_PAT, PAT_VALUE);
+        wbinvd();
+        irq_restore(flags);
+    }
+
+    write_cr4(read_cr4() | CR4_PSE);
+    write_cr3((uint32_t)(uintptr_t)page_directory);
+    write_cr0(read_cr0() | CR0_PG);
+    paging_on = 1;
+
+    /* all of video memory: fb_pages_init() puts more pages past the screen */
+    uint32_t fb_size = (uint32_t)vesa_mode_info.BytesPerScanLine * vesa_mode_info.YResolution;
+    if (vesa_vram_bytes > fb_size) fb_size = vesa_vram_bytes;
+    mmio_map(vesa_mode_info.PhysBasePtr, fb_size, CACHE_WC);
+}
@@ -0,0 +1,196 @@
+// mm/pmm.c -- buddy page frame allocator on top of the BIOS E820 map
+//
+// One state byte per 4 KiB frame from physical 0 to the top of usable RAM:
+// the first frame of a free block holds FRAME_FREE | order, everything else
+// is 0. Free blocks of each order sit on a doubly linked list threaded
+// through the free pages themselves. Memory below 1 MiB (kernel image, boot
+// heap, BIOS areas) is never handed out.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <pmm.h>
+#include <cyrillic.h>
+
+#define PMM_LOW_LIMIT   0x100000u
+#define PMM_HIGH_LIMIT  0xFFFFF000u     /* no PAE, stay below 4 GiB */
+#define FRAME_FREE      0x80
+
+typedef struct free_block {
+    struct free_block* next;
+    struct free_block* prev;
+} free_block_t;
+
+static e820_entry_t e820_map[E820_MAX];
+static uint32_t e820_count = 0;
+
+static uint8_t* frame_state = NULL;
+static uint32_t frame_count = 0;
+static free_block_t* free_lists[PMM_MAX_ORDER + 1];
+static uint32_t free_counts[PMM_MAX_ORDER + 1];
+static uint32_t free_pages = 0;
+static uint32_t total_pages = 0;
+
+static inline void* frame_to_addr(uint32_t frame) { return (void*)((uintptr_t)frame * PAGE_SIZE); }
+static inline uint32_t addr_to_frame(void* addr) { return (uint32_t)((uintptr_t)addr / PAGE_SIZE); }
+
+static void list_push(unsigned int order, uint32_t frame) {
+    free_block_t* b = frame_to_addr(frame);
+    b->prev = NULL;
+    b->next = free_lists[order];
+    if (b->next) b->next->prev = b;
+    free_lists[order] = b;
+    free_counts[order]++;
+    frame_state[frame] = FRAME_FREE | order;
+}
+
+static void list_remove(unsigned int order, uint32_t frame) {
+    free_block_t* b = frame_to_addr(frame);
+    if (b->prev) b->prev->next = b->next;
+    else free_lists[order] = b->next;
+    if (b->next) b->next->prev = b->prev;
+    free_counts[order]--;
+    frame_state[frame] = 0;
+}
+
+static void free_block(uint32_t frame, unsigned int order) {
+    free_pages += 1u << order;
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = frame ^ (1u << order);
+        if (buddy >= frame_count || frame_state[buddy] != (FRAME_FREE | order)) break;
+        list_remove(order, buddy);
+        if (buddy < frame) frame = buddy;
+        order++;
+    }
+    list_push(order, frame);
+}
+
+/* free [start, end) frames in the biggest naturally aligned blocks that fit */
+static void free_range(uint32_t start, uint32_t end) {
+    while (start < end) {
+        unsigned int order = PMM_MAX_ORDER;
+        while (order > 0 && ((start & ((1u << order) - 1)) || start + (1u << order) > end))
+            order--;
+        free_block(start, order);
+        start += 1u << order;
+    }
+}
+
+/* clip an E820 entry to whole frames in [PMM_LOW_LIMIT, PMM_HIGH_LIMIT) */
+static int usable_frames(const e820_entry_t* e, uint32_t* first, uint32_t* last) {
+    if (e->type != E820_USABLE) return 0;
+    uint64_t base = e->base;
+    uint64_t end = e->base + e->length;
+    if (base < PMM_LOW_LIMIT) base = PMM_LOW_LIMIT;
+    if (end > PMM_HIGH_LIMIT) end = PMM_HIGH_LIMIT;
+    base = (base + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    end &= ~(uint64_t)(PAGE_SIZE - 1);
+    if (end <= base) return 0;
+    *first = (uint32_t)(base / PAGE_SIZE);
+    *last = (uint32_t)(end / PAGE_SIZE);
+    return 1;
+}
+
+void pmm_init(const e820_entry_t* map, uint32_t count) {
+    if (count > E820_MAX) count = E820_MAX;
+    memcpy(e820_map, map, count * sizeof(e820_entry_t));
+    e820_count = count;
+
+    uint32_t first, last;
+    for (uint32_t i = 0; i < count; i++) {
+        if (usable_frames(&e820_map[i], &first, &last) && last > frame_count)
+            frame_count = last;
+    }
+    if (!frame_count) return;
+
+    /* the state array goes at the start of the first region big enough */
+    uint32_t meta_frames = (frame_count + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t meta_first = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (usable_frames(&e820_map[i], &first, &last) && last - first > meta_frames) {
+            meta_first = first;
+            break;
+        }
+    }
+    if (!meta_first) {
+        frame_count = 0;
+        return;
+    }
+    frame_state = frame_to_addr(meta_first);
+    memset(frame_state, 0, frame_count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!usable_frames(&e820_map[i], &first, &last)) continue;
+        if (first == meta_first) first += meta_frames;
+        total_pages += last - first;
+        free_range(first, last);
+    }
+}
+
+void* pmm_alloc_pages(unsigned int order) {
+    if (order > PMM_MAX_ORDER) return NULL;
+
+    unsigned int o = order;
+    while (o <= PMM_MAX_ORDER && !free_lists[o]) o++;
+    if (o > PMM_MAX_ORDER) return NULL;
+
+    uint32_t frame = addr_to_frame(free_lists[o]);
+    list_remove(o, frame);
+
+    /* split, handing the upper halves back */
+    while (o > order) {
+        o--;
+        list_push(o, frame + (1u << o));
+    }
+
+    free_pages -= 1u << order;
+    return frame_to_addr(frame);
+}
+
+void pmm_free_pages(void* addr, unsigned int order) {
+    if (!addr || order > PMM_MAX_ORDER) return;
+    uint32_t frame = addr_to_frame(addr);
+    if (frame + (1u << order) > frame_count) return;
+    free_block(frame, order);
+}
+
+uintptr_t pmm_top(void) {
+    return (uintptr_t)frame_count * PAGE_SIZE;
+}
+
+size_t pmm_total_bytes(void) {
+    return (size_t)total_pages * PAGE_SIZE;
+}
+
+size_t pmm_free_bytes(void) {
+    return (size_t)free_pages * PAGE_SIZE;
+}
+
+static const char* e820_type_name(uint32_t type) {
+    switch (type) {
+        case E820_USABLE:   return "usable";
+        case E820_RESERVED: return "reserved";
+        case E820_ACPI:     return "ACPI reclaimable";
+        case E820_NVS:      return "ACPI NVS";
+        case E820_BAD:      return "bad";
+        default:            return "unknown";
+    }
+}
+
+void pmm_info(void) {
+    printf("E820 map (%u entries):\n", e820_count);
+    for (uint32_t i = 0; i < e820_count; i++) {
+        const e820_entry_t* e = &e820_map[i];
+        uint64_t end = e->base + e->length - 1;
+        printf("  %08X%08X-%08X%08X %s\n",
+               (uint32_t)(e->base >> 32), (uint32_t)e->base,
+               (uint32_t)(end >> 32), (uint32_t)end,
+               e820_type_name(e->type));
+    }
+    printf("Pages: %u KiB managed, %u KiB free\n",
+           total_pages * (PAGE_SIZE / 1024), free_pages * (PAGE_SIZE / 1024));
+    printf("Free blocks per order:");
+    for (unsigned int o = 0; o <= PMM_MAX_ORDER; o++) printf(" %u", free_counts[o]);
+    printf("\n");
+}
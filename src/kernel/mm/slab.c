@@ -0,0 +1,245 @@
+// mm/slab.c -- slab object caches
+//
+// A slab is SLAB_SIZE (or a power of two multiple for big objects) bytes,
+// aligned to its own size, with a slab_t header at the start followed by the
+// objects. Aligning slabs lets kmem_cache_free find the header by masking the
+// object address. Each cache keeps partial, full and empty slab lists; one
+// empty slab is kept around so alloc/free churn at a slab boundary does not
+// hit the heap every time.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <heap.h>
+#include <slab.h>
+#include <cyrillic.h>
+
+#define SLAB_SIZE       4096u
+#define SLAB_SIZE_MAX   65536u
+#define SLAB_MIN_OBJS   8u
+#define CACHE_NAME_LEN  16
+
+#define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((size_t)(a) - 1))
+
+typedef struct slab {
+    struct slab* next;
+    struct slab* prev;
+    void* free;             /* first free object */
+    unsigned int inuse;
+} slab_t;
+
+struct kmem_cache {
+    char name[CACHE_NAME_LEN];
+    size_t obj_size;        /* as requested */
+    size_t stride;          /* distance between objects */
+    size_t link_off;        /* where the free list link lives inside an object */
+    size_t first_off;       /* offset of the first object in a slab */
+    size_t slab_size;
+    unsigned int per_slab;
+    void (*ctor)(void*);
+
+    slab_t* partial;
+    slab_t* full;
+    slab_t* empty;
+
+    /* counters */
+    unsigned int slabs;
+    unsigned int active;
+    unsigned int allocs;
+    unsigned int frees;
+
+    struct kmem_cache* next;
+};
+
+static void cache_setup(kmem_cache_t* c, const char* name, size_t size, size_t align,
+                        void (*ctor)(void*));
+
+/* caches are objects too, they come from this statically set up cache */
+static kmem_cache_t cache_cache;
+static kmem_cache_t* cache_list = NULL;
+static int is_init = 0;
+
+static void slab_init() {
+    if (is_init) return;
+    is_init = 1;
+    cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0, NULL);
+}
+
+static inline void** obj_link(kmem_cache_t* c, void* obj) {
+    return (void**)((char*)obj + c->link_off);
+}
+
+static inline slab_t* obj_slab(kmem_cache_t* c, void* obj) {
+    return (slab_t*)((uintptr_t)obj & ~((uintptr_t)c->slab_size - 1));
+}
+
+static void list_push(slab_t** head, slab_t* s) {
+    s->prev = NULL;
+    s->next = *head;
+    if (*head) (*head)->prev = s;
+    *head = s;
+}
+
+static void list_remove(slab_t** head, slab_t* s) {
+    if (s->prev) s->prev->next = s->next;
+    else *head = s->next;
+    if (s->next) s->next->prev = s->prev;
+}
+
+static void cache_setup(kmem_cache_t* c, const char* name, size_t size, size_t align,
+                        void (*ctor)(void*)) {
+    memset(c, 0, sizeof(*c));
+    strncpy(c->name, name ? name : "?", CACHE_NAME_LEN - 1);
+
+    if (align < sizeof(void*)) align = sizeof(void*);
+    c->obj_size = size;
+    c->ctor = ctor;
+
+    /* constructed objects must survive on the free list, so with a ctor the
+       link gets its own word behind the object instead of overlaying it */
+    if (ctor) {
+        c->link_off = ALIGN_UP(size, sizeof(void*));
+        c->stride = ALIGN_UP(c->link_off + sizeof(void*), align);
+    } else {
+        c->link_off = 0;
+        c->stride = ALIGN_UP(size < sizeof(void*) ? sizeof(void*) : size, align);
+    }
+
+    c->first_off = ALIGN_UP(sizeof(slab_t), align);
+    c->slab_size = SLAB_SIZE;
+    while (c->slab_size < SLAB_SIZE_MAX &&
+           (c->slab_size - c->first_off) / c->stride < SLAB_MIN_OBJS)
+        c->slab_size <<= 1;
+    c->per_slab = (unsigned int)((c->slab_size - c->first_off) / c->stride);
+}
+
+static slab_t* slab_create(kmem_cache_t* c) {
+    slab_t* s = aligned_alloc(c->slab_size, c->slab_size);
+    if (!s) {
+        DEBUG_PRINT("[slab] %s: out of memory\n", c->name);
+        return NULL;
+    }
+
+    s->inuse = 0;
+    s->free = NULL;
+
+    /* thread the free list back to front so objects go out in address order */
+    char* base = (char*)s + c->first_off;
+    for (unsigned int i = c->per_slab; i-- > 0;) {
+        void* obj = base + i * c->stride;
+        if (c->ctor) c->ctor(obj);
+        *obj_link(c, obj) = s->free;
+        s->free = obj;
+    }
+
+    c->slabs++;
+    return s;
+}
+
+static void slab_destroy(kmem_cache_t* c, slab_t* s) {
+    c->slabs--;
+    free(s);
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align,
+                                void (*ctor)(void* obj)) {
+    slab_init();
+    if (!size || (align & (align - 1))) return NULL;
+
+    kmem_cache_t* c = kmem_cache_alloc(&cache_cache);
+    if (!c) return NULL;
+
+    cache_setup(c, name, size, align, ctor);
+    if (c->per_slab == 0) {
+        kmem_cache_free(&cache_cache, c);
+        return NULL;
+    }
+
+    c->next = cache_list;
+    cache_list = c;
+    return c;
+}
+
+void* kmem_cache_alloc(kmem_cache_t* c) {
+    slab_t* s = c->partial;
+    if (!s) {
+        s = c->empty;
+        if (s) c->empty = NULL;
+        else s = slab_create(c);
+        if (!s) return NULL;
+        list_push(&c->partial, s);
+    }
+
+    void* obj = s->free;
+    s->free = *obj_link(c, obj);
+    s->inuse++;
+    if (!s->free) {
+        list_remove(&c->partial, s);
+        list_push(&c->full, s);
+    }
+
+    c->active++;
+    c->allocs++;
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t* c, void* obj) {
+    if (!obj) return;
+    slab_t* s = obj_slab(c, obj);
+
+    if (!s->free) {
+        list_remove(&c->full, s);
+        list_push(&c->partial, s);
+    }
+    *obj_link(c, obj) = s->free;
+    s->free = obj;
+    s->inuse--;
+
+    c->active--;
+    c->frees++;
+
+    if (s->inuse == 0) {
+        list_remove(&c->partial, s);
+        if (c->empty) slab_destroy(c, c->empty);
+        c->empty = s;
+    }
+}
+
+void kmem_cache_destroy(kmem_cache_t* c) {
+    if (!c) return;
+    if (c->active) {
+        DEBUG_PRINT("[slab] %s: destroyed with %u objects still in use\n", c->name, c->active);
+    }
+
+    slab_t* lists[3] = {c->partial, c->full, c->empty};
+    for (int i = 0; i < 3; i++) {
+        slab_t* s = lists[i];
+        while (s) {
+            slab_t* next = (i == 2) ? NULL : s->next;
+            slab_destroy(c, s);
+            s = next;
+        }
+    }
+
+    kmem_cache_t** p = &cache_list;
+    while (*p && *p != c) p = &(*p)->next;
+    if (*p) *p = c->next;
+
+    kmem_cache_free(&cache_cache, c);
+}
+
+static void cache_print(kmem_cache_t* c) {
+    printf("%-16s %6u %6u %6u %6u %10u %10u\n", c->name,
+           (unsigned int)c->obj_size, c->active, c->slabs * c->per_slab,
+           c->slabs, c->allocs, c->frees);
+}
+
+void kmem_cache_info(void) {
+    slab_init();
+    printf("%-16s %6s %6s %6s %6s %10s %10s\n",
+           "cache", "size", "active", "total", "slabs", "allocs", "frees");
+    cache_print(&cache_cache);
+    for (kmem_cache_t* c = cache_list; c; c = c->next) cache_print(c);
+}
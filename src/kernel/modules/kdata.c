@@ -1,3 +1,5 @@
 #include <vesa.h>
 
-mode_info_t vesa_mode_info;
\ No newline at end of file
+mode_info_t vesa_mode_info;
+uint16_t vesa_mode_number;
+uint32_t vesa_vram_bytes;
\ No newline at end of file
@@ -0,0 +1,66 @@
+// modules/video/dispi.c -- Bochs / QEMU std-vga DISPI registers
+//
+// The VBE BIOS of Bochs and QEMU's std-vga sets modes through these
+// registers, so once entry.s has set a linear mode they describe it. Only
+// the virtual height and the Y offset are touched here: a taller virtual
+// framebuffer keeps the pitch, and the offset picks which rows are shown.
+
+#include <stdint.h>
+#include <vesa.h>
+#include <dispi.h>
+#include <asm.h>
+
+extern mode_info_t vesa_mode_info;
+
+#define DISPI_INDEX_PORT    0x1CE
+#define DISPI_DATA_PORT     0x1CF
+
+#define DISPI_ID            0
+#define DISPI_XRES          1
+#define DISPI_YRES          2
+#define DISPI_BPP           3
+#define DISPI_ENABLE        4
+#define DISPI_VIRT_WIDTH    6
+#define DISPI_VIRT_HEIGHT   7
+#define DISPI_X_OFFSET      8
+#define DISPI_Y_OFFSET      9
+
+#define DISPI_ID1           0xB0C1  /* first with virtual size and offsets */
+#define DISPI_ID_MAX        0xB0CF
+#define DISPI_ENABLED       0x01
+
+static inline uint16_t dispi_read(uint16_t index) {
+    outw(DISPI_INDEX_PORT, index);
+    return inw(DISPI_DATA_PORT);
+}
+
+static inline void dispi_write(uint16_t index, uint16_t value) {
+    outw(DISPI_INDEX_PORT, index);
+    outw(DISPI_DATA_PORT, value);
+}
+
+int dispi_init(int rows) {
+    const mode_info_t *m = &vesa_mode_info;
+    uint16_t id = dispi_read(DISPI_ID);
+    if (id < DISPI_ID1 || id > DISPI_ID_MAX) return 0;
+
+    /* the mode has to be the one the DISPI registers describe */
+    if (!(dispi_read(DISPI_ENABLE) & DISPI_ENABLED)) return 0;
+    if (dispi_read(DISPI_XRES) != m->XResolution || dispi_read(DISPI_YRES) != m->YResolution ||
+        dispi_read(DISPI_BPP) != m->BitsPerPixel)
+        return 0;
+    if ((uint32_t)dispi_read(DISPI_VIRT_WIDTH) * ((m->BitsPerPixel + 7) / 8) != m->BytesPerScanLine)
+        return 0;
+
+    /* Bochs takes the height as asked, QEMU always reports what fits */
+    if (rows > 0xFFFF) rows = 0xFFFF;
+    dispi_write(DISPI_VIRT_HEIGHT, (uint16_t)rows);
+    int got = dispi_read(DISPI_VIRT_HEIGHT);
+    dispi_write(DISPI_X_OFFSET, 0);
+    dispi_write(DISPI_Y_OFFSET, 0);
+    return got < rows ? got : rows;
+}
+
+void dispi_set_y_offset(int y) {
+    dispi_write(DISPI_Y_OFFSET, (uint16_t)y);
+}
@@ -0,0 +1,264 @@
+// modules/video/pixfmt.c -- drawing ops, one table per pixel format
+//
+// Every format gets its own colour conversion, pixel store, span fill, blit
+// and glyph functions, stamped out by PIXFMT() below with the channel layout
+// and pixel size as constants, so none of them branch on the format.
+// vesa_init() installs the table for the mode entry.s set; vesa.c and text.c
+// only ever call through fb_ops.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vesa.h>
+#include <text.h>
+#include <cpu.h>
+
+extern mode_info_t vesa_mode_info;
+
+typedef uint32_t __attribute__((may_alias)) pix_word_t;
+typedef uint16_t __attribute__((may_alias)) pix_half_t;
+
+/* ——— Span fills ———
+ * 32 bit spans are rep stosl (SSE2 stores where the CPU has them), 16 bit
+ * ones the colour doubled into a word, 24 bit ones a 12 byte pattern of four
+ * pixels. The SSE2 path is safe from interrupts too, see irq_fxsave in cpu.h.
+ */
+
+ALT_IMPL static void fill32_words(uint32_t *dst, uint32_t color, size_t n) {
+    __asm__ volatile ("rep stosl" : "+D"(dst), "+c"(n) : "a"(color) : "memory");
+}
+
+/* aligned 16 byte stores, 64 bytes a loop */
+ALT_IMPL SSE2_FN static void fill32_sse2(uint32_t *dst, uint32_t color, size_t n) {
+    while (n && ((uintptr_t)dst & 15)) {
+        *dst++ = color;
+        n--;
+    }
+    size_t chunks = n / 16;
+    if (chunks) {
+        __asm__ volatile (
+            "movd %2, %%xmm0\n\t"
+            "pshufd $0, %%xmm0, %%xmm0\n\t"
+            "1:\n\t"
+            "movdqa %%xmm0,  0(%0)\n\t"
+            "movdqa %%xmm0, 16(%0)\n\t"
+            "movdqa %%xmm0, 32(%0)\n\t"
+            "movdqa %%xmm0, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "dec %1\n\t"
+            "jnz 1b"
+            : "+r"(dst), "+r"(chunks)
+            : "r"(color)
+            : "xmm0", "memory", "cc");
+    }
+    for (n &= 15; n; n--) *dst++ = color;
+}
+
+void fb_fill32(uint32_t *dst, uint32_t color, size_t n);
+ALT_ENTRY(fb_fill32, fill32_words);
+ALTERNATIVE(fb_fill32, fill32_sse2, CPU_SSE2);
+
+static void span32(uint8_t *dst, uint32_t color, size_t n) {
+    fb_fill32((uint32_t*)dst, color, n);
+}
+
+static void span24(uint8_t *dst, uint32_t color, size_t n) {
+    /* bgrb grbg rbgr: four pixels in three words */
+    color &= 0xFFFFFF;
+    uint32_t w0 = color | color << 24;
+    uint32_t w1 = color >> 8 | color << 16;
+    uint32_t w2 = color >> 16 | color << 8;
+    pix_word_t *d = (pix_word_t*)dst;
+    for (size_t i = n / 4; i; i--, d += 3) {
+        d[0] = w0; d[1] = w1; d[2] = w2;
+    }
+    dst = (uint8_t*)d;
+    for (n &= 3; n; n--, dst += 3) {
+        dst[0] = (uint8_t)color;
+        dst[1] = (uint8_t)(color >> 8);
+        dst[2] = (uint8_t)(color >> 16);
+    }
+}
+
+static void span16(uint8_t *dst, uint32_t color, size_t n) {
+    if (n && ((uintptr_t)dst & 2)) {
+        *(pix_half_t*)dst = (uint16_t)color;
+        dst += 2;
+        n--;
+    }
+    fb_fill32((uint32_t*)dst, (color & 0xFFFF) * 0x00010001u, n / 2);
+    if (n & 1) *(pix_half_t*)(dst + (n & ~(size_t)1) * 2) = (uint16_t)color;
+}
+
+/* ——— Glyphs ———
+ * A glyph row table has, for each of the 256 bit patterns, that 8 pixel row
+ * in the table's format and one fg/bg pair, so a glyph is 16 row copies of
+ * whole words.
+ */
+
+static void glyph16(uint8_t *dst, size_t pitch, const uint8_t *bitmap, fb_glyph_row_t *rows) {
+    for (int row = 0; row < CHAR_HEIGHT; ++row, dst += pitch) {
+        const pix_word_t *s = (const pix_word_t *)rows[bitmap[row]];
+        pix_word_t *d = (pix_word_t *)dst;
+        d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3];
+    }
+}
+
+static void glyph24(uint8_t *dst, size_t pitch, const uint8_t *bitmap, fb_glyph_row_t *rows) {
+    for (int row = 0; row < CHAR_HEIGHT; ++row, dst += pitch) {
+        const pix_word_t *s = (const pix_word_t *)rows[bitmap[row]];
+        pix_word_t *d = (pix_word_t *)dst;
+        d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3]; d[4] = s[4]; d[5] = s[5];
+    }
+}
+
+ALT_IMPL static void glyph32_words(uint8_t *dst, size_t pitch, const uint8_t *bitmap, fb_glyph_row_t *rows) {
+    for (int row = 0; row < CHAR_HEIGHT; ++row, dst += pitch) {
+        const pix_word_t *s = (const pix_word_t *)rows[bitmap[row]];
+        pix_word_t *d = (pix_word_t *)dst;
+        d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3];
+        d[4] = s[4]; d[5] = s[5]; d[6] = s[6]; d[7] = s[7];
+    }
+}
+
+/* two 16 byte stores per row */
+ALT_IMPL SSE2_FN static void glyph32_sse2(uint8_t *dst, size_t pitch, const uint8_t *bitmap, fb_glyph_row_t *rows) {
+    for (int row = 0; row < CHAR_HEIGHT; ++row, dst += pitch) {
+        __asm__ volatile (
+            "movdqa   (%1), %%xmm0\n\t"
+            "movdqa 16(%1), %%xmm1\n\t"
+            "movdqu %%xmm0,   (%0)\n\t"
+            "movdqu %%xmm1, 16(%0)"
+            : : "r"(dst), "r"(rows[bitmap[row]]) : "xmm0", "xmm1", "memory");
+    }
+}
+
+void glyph32(uint8_t *dst, size_t pitch, const uint8_t *bitmap, fb_glyph_row_t *rows);
+ALT_ENTRY(glyph32, glyph32_words);
+ALTERNATIVE(glyph32, glyph32_sse2, CPU_SSE2);
+
+/* ——— Per-format tables ———
+ * The helpers take the pixel size as an argument; PIXFMT() only ever passes
+ * a constant, so each generated function is left with a single store.
+ */
+
+static inline void store_pixel(uint8_t *dst, uint32_t color, const unsigned int bytes) {
+    switch (bytes) {
+        case 4: *(pix_word_t*)dst = color; break;
+        case 3:
+            dst[0] = (uint8_t)color;
+            dst[1] = (uint8_t)(color >> 8);
+            dst[2] = (uint8_t)(color >> 16);
+            break;
+        case 2: *(pix_half_t*)dst = (uint16_t)color; break;
+    }
+}
+
+static inline void blit_rows(uint8_t *dst, size_t dst_pitch, const uint8_t *src, size_t src_pitch,
+                             int w, int h, const unsigned int bytes) {
+    size_t n = (size_t)w * bytes;
+    if (n == dst_pitch && n == src_pitch) {
+        memcpy(dst, src, n * (size_t)h);
+        return;
+    }
+    for (; h > 0; h--, dst += dst_pitch, src += src_pitch) memcpy(dst, src, n);
+}
+
+static inline void build_glyph_rows(fb_glyph_row_t *rows, uint32_t fg, uint32_t bg, const unsigned int bytes) {
+    for (unsigned int bits = 0; bits < 256; ++bits) {
+        uint8_t *row = rows[bits];
+        for (unsigned int col = 0; col < CHAR_WIDTH; ++col)
+            store_pixel(row + col * bytes, (bits & (0x80u >> col)) ? fg : bg, bytes);
+    }
+}
+
+/* channels as the mode info describes them, for layouts without a table */
+static uint32_t mask_channel(uint8_t v, uint8_t size, uint8_t pos) {
+    return (uint32_t)(v >> (8 - size)) << pos;
+}
+
+static uint32_t mask_color(uint8_t r, uint8_t g, uint8_t b) {
+    return mask_channel(r, vesa_mode_info.RedMaskSize, vesa_mode_info.RedMaskPos) |
+           mask_channel(g, vesa_mode_info.GreenMaskSize, vesa_mode_info.GreenMaskPos) |
+           mask_channel(b, vesa_mode_info.BlueMaskSize, vesa_mode_info.BlueMaskPos);
+}
+
+#define PIXFMT_COLOR(name, rs, rp, gs, gp, bs, bp)                                  \
+    static uint32_t name##_color(uint8_t r, uint8_t g, uint8_t b) {                 \
+        return (uint32_t)(r >> (8 - rs)) << rp | (uint32_t)(g >> (8 - gs)) << gp |   \
+               (uint32_t)(b >> (8 - bs)) << bp;                                      \
+    }
+
+#define PIXFMT_STORE(bits)                                                          \
+    static void pixel##bits(uint8_t *dst, uint32_t color) {                         \
+        store_pixel(dst, color, bits / 8);                                          \
+    }                                                                               \
+    static void blit##bits(uint8_t *dst, size_t dst_pitch, const uint8_t *src,      \
+                           size_t src_pitch, int w, int h) {                        \
+        blit_rows(dst, dst_pitch, src, src_pitch, w, h, bits / 8);                  \
+    }                                                                               \
+    static void glyph_rows##bits(fb_glyph_row_t *rows, uint32_t fg, uint32_t bg) {  \
+        build_glyph_rows(rows, fg, bg, bits / 8);                                   \
+    }
+
+#define PIXFMT(var, name, bits, color) \
+    const fb_ops_t var = { name, bits / 8, color, pixel##bits, span##bits, \
+                           blit##bits, glyph_rows##bits, glyph##bits }
+
+PIXFMT_STORE(32)
+PIXFMT_STORE(24)
+PIXFMT_STORE(16)
+
+PIXFMT_COLOR(rgb888, 8, 16, 8, 8, 8, 0)
+PIXFMT_COLOR(rgb565, 5, 11, 6, 5, 5, 0)
+PIXFMT_COLOR(rgb555, 5, 10, 5, 5, 5, 0)
+
+/* opaque: images in this format blend, see surface.c */
+static uint32_t argb8888_color(uint8_t r, uint8_t g, uint8_t b) {
+    return 0xFF000000u | rgb888_color(r, g, b);
+}
+
+PIXFMT(fb_xrgb8888, "xrgb8888", 32, rgb888_color);
+PIXFMT(fb_argb8888, "argb8888", 32, argb8888_color);
+PIXFMT(fb_rgb888, "rgb888", 24, rgb888_color);
+PIXFMT(fb_rgb565, "rgb565", 16, rgb565_color);
+PIXFMT(fb_rgb555, "rgb555", 16, rgb555_color);
+static PIXFMT(masked32, "masked32", 32, mask_color);
+static PIXFMT(masked24, "masked24", 24, mask_color);
+static PIXFMT(masked16, "masked16", 16, mask_color);
+
+/* no linear mode we can draw in (or none set yet): everything is a no-op */
+static uint32_t none_color(uint8_t r, uint8_t g, uint8_t b) { (void)r; (void)g; (void)b; return 0; }
+static void none_pixel(uint8_t *dst, uint32_t color) { (void)dst; (void)color; }
+static void none_span(uint8_t *dst, uint32_t color, size_t n) { (void)dst; (void)color; (void)n; }
+static void none_blit(uint8_t *dst, size_t dst_pitch, const uint8_t *src, size_t src_pitch, int w, int h) {
+    (void)dst; (void)dst_pitch; (void)src; (void)src_pitch; (void)w; (void)h;
+}
+static void none_glyph_rows(fb_glyph_row_t *rows, uint32_t fg, uint32_t bg) { (void)rows; (void)fg; (void)bg; }
+static void none_glyph(uint8_t *dst, size_t pitch, const uint8_t *bitmap, fb_glyph_row_t *rows) {
+    (void)dst; (void)pitch; (void)bitmap; (void)rows;
+}
+static const fb_ops_t none = { "none", 0, none_color, none_pixel, none_span,
+                               none_blit, none_glyph_rows, none_glyph };
+
+const fb_ops_t *fb_ops = &none;
+
+static int masks_are(uint8_t rs, uint8_t rp, uint8_t gs, uint8_t gp, uint8_t bs, uint8_t bp) {
+    const mode_info_t *m = &vesa_mode_info;
+    return m->RedMaskSize == rs && m->RedMaskPos == rp && m->GreenMaskSize == gs &&
+           m->GreenMaskPos == gp && m->BlueMaskSize == bs && m->BlueMaskPos == bp;
+}
+
+void vesa_init(void) {
+    const mode_info_t *m = &vesa_mode_info;
+    /* VBE 1.x modes leave the masks at zero and mean the usual layout */
+    int standard = !m->RedMaskSize && !m->GreenMaskSize && !m->BlueMaskSize;
+
+    if (!m->PhysBasePtr) fb_ops = &none;
+    else if (m->BitsPerPixel == 32) fb_ops = standard || masks_are(8, 16, 8, 8, 8, 0) ? &fb_xrgb8888 : &masked32;
+    else if (m->BitsPerPixel == 24) fb_ops = standard || masks_are(8, 16, 8, 8, 8, 0) ? &fb_rgb888 : &masked24;
+    else if (m->BitsPerPixel == 16 && (standard || masks_are(5, 11, 6, 5, 5, 0))) fb_ops = &fb_rgb565;
+    else if (m->BitsPerPixel == 15 || (m->BitsPerPixel == 16 && masks_are(5, 10, 5, 5, 5, 0))) fb_ops = &fb_rgb555;
+    else if (m->BitsPerPixel == 16) fb_ops = &masked16;
+    else fb_ops = &none;
+}
@@ -0,0 +1,318 @@
+// modules/video/raster.c -- scanline rasteriser for lines, ellipses and polygons
+//
+// Every shape is turned into horizontal spans and handed to fb_span(), which
+// fills them through the format's span routine, so drawing costs the pixels
+// covered and nothing per pixel above that. Damage is the bounding box,
+// reported once per shape.
+//
+// Polygons are scan converted with an active edge list. Coordinates are kept
+// in 1/16 pixel so thick lines can be drawn as exact quads; each edge steps
+// from row to row with an integer error term (Bresenham style), the only
+// division is per edge. A pixel belongs to the polygon when its centre does,
+// with crossings rounded the same way on both sides, so neighbouring polygons
+// share no pixels and leave no gaps.
+//
+// Ellipses walk the rows from the middle out, shrinking the half width while
+// the point falls outside (x / (rx + 1/2))^2 + (y / (ry + 1/2))^2 <= 1.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vesa.h>
+#include <raster.h>
+
+extern mode_info_t vesa_mode_info;
+
+#define SUB_BITS 4
+#define SUB      (1 << SUB_BITS)    /* subpixel steps per pixel */
+#define HALF     (SUB / 2)
+
+typedef struct {
+    int ytop, ybot;     /* rows [ytop, ybot) */
+    int x;              /* first pixel whose centre is right of the crossing */
+    int dir;            /* +1 downwards, -1 upwards */
+    int step;           /* whole pixels per row */
+    int64_t err, rem, den;
+} edge_t;
+
+static edge_t edges[RASTER_MAX_POINTS];
+static edge_t *active[RASTER_MAX_POINTS];
+
+/* floor(n / d) for d > 0 and a quotient that fits 32 bits; a plain 64 bit
+   division would want libgcc on i386, idiv does this one in an instruction */
+static inline int32_t div_floor(int64_t n, int32_t d) {
+    int32_t q, r;
+#ifdef __i386__
+    __asm__ ("idivl %4" : "=a"(q), "=d"(r) : "a"((uint32_t)n), "d"((uint32_t)((uint64_t)n >> 32)), "rm"(d));
+#else
+    q = (int32_t)(n / d);
+    r = (int32_t)(n % d);
+#endif
+    return r < 0 ? q - 1 : q;
+}
+
+static inline int ceil_sub(int v) {
+    /* ceil(v / SUB), arithmetic shift */
+    return -(-v >> SUB_BITS);
+}
+
+static inline int on_screen(int x0, int y0, int x1, int y1) {
+    return x1 >= 0 && y1 >= 0 && x0 < vesa_mode_info.XResolution && y0 < vesa_mode_info.YResolution;
+}
+
+static uint64_t isqrt64(uint64_t v) {
+    uint64_t r = 0, bit = (uint64_t)1 << 62;
+    while (bit > v) bit >>= 2;
+    for (; bit; bit >>= 2) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+    }
+    return r;
+}
+
+/* ——— Polygons ——— */
+
+/* edge from a to b (1/SUB pixel), clipped to the rows of the screen; 0 when
+   it crosses no pixel centre there */
+static int edge_init(edge_t *e, point_t a, point_t b) {
+    if (a.y == b.y) return 0;
+    e->dir = 1;
+    if (a.y > b.y) {
+        point_t t = a; a = b; b = t;
+        e->dir = -1;
+    }
+    /* rows whose centre y * SUB + HALF is in [a.y, b.y) */
+    e->ytop = ceil_sub(a.y - HALF);
+    e->ybot = ceil_sub(b.y - HALF);
+    if (e->ytop < 0) e->ytop = 0;
+    if (e->ybot > vesa_mode_info.YResolution) e->ybot = vesa_mode_info.YResolution;
+    if (e->ytop >= e->ybot) return 0;
+
+    /* at a centre row c the crossing is a.x + (c - a.y) * dx / dy, and the
+       first pixel right of it is ceil(num / den) with the den below; num
+       grows by SUB * dx per row, kept as x * den - err, 0 <= err < den */
+    int64_t dx = b.x - a.x, dy = b.y - a.y;
+    int64_t den = dy * SUB;
+    int64_t num = (int64_t)(a.x - HALF) * dy + ((int64_t)e->ytop * SUB + HALF - a.y) * dx;
+    e->x = -div_floor(-num, (int32_t)den);
+    e->err = (int64_t)e->x * den - num;
+    e->step = div_floor(dx * SUB, (int32_t)den);
+    e->rem = dx * SUB - (int64_t)e->step * den;
+    e->den = den;
+    return 1;
+}
+
+static inline void edge_step(edge_t *e) {
+    e->x += e->step;
+    e->err -= e->rem;
+    if (e->err < 0) {
+        e->err += e->den;
+        e->x++;
+    }
+}
+
+/* fill the polygon through v[0..n) (1/SUB pixel, nonzero winding) */
+static void scan_polygon(const point_t *v, int n, uint32_t color) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        edge_t e;
+        if (!edge_init(&e, v[i], v[i + 1 == n ? 0 : i + 1])) continue;
+        /* sorted by top row */
+        int j = count++;
+        for (; j > 0 && edges[j - 1].ytop > e.ytop; j--) edges[j] = edges[j - 1];
+        edges[j] = e;
+    }
+
+    int next = 0, live = 0, y = 0;
+    while (next < count || live) {
+        if (!live && y < edges[next].ytop) y = edges[next].ytop;
+        for (; next < count && edges[next].ytop == y; next++) active[live++] = &edges[next];
+
+        /* by x; the order barely changes from row to row */
+        for (int i = 1; i < live; i++) {
+            edge_t *e = active[i];
+            int j = i;
+            for (; j > 0 && active[j - 1]->x > e->x; j--) active[j] = active[j - 1];
+            active[j] = e;
+        }
+
+        int winding = 0, start = 0;
+        for (int i = 0; i < live; i++) {
+            int was = winding;
+            winding += active[i]->dir;
+            if (!was) start = active[i]->x;
+            else if (!winding) fb_span(y, start, active[i]->x, color);
+        }
+
+        y++;
+        int kept = 0;
+        for (int i = 0; i < live; i++) {
+            if (active[i]->ybot == y) continue;
+            edge_step(active[i]);
+            active[kept++] = active[i];
+        }
+        live = kept;
+    }
+}
+
+/* bounding box of v[0..n) in whole pixels as damage */
+static void damage_points(const point_t *v, int n) {
+    int x0 = v[0].x, y0 = v[0].y, x1 = v[0].x, y1 = v[0].y;
+    for (int i = 1; i < n; i++) {
+        if (v[i].x < x0) x0 = v[i].x;
+        if (v[i].x > x1) x1 = v[i].x;
+        if (v[i].y < y0) y0 = v[i].y;
+        if (v[i].y > y1) y1 = v[i].y;
+    }
+    x0 >>= SUB_BITS;
+    y0 >>= SUB_BITS;
+    fb_damage(x0, y0, ceil_sub(x1) - x0, ceil_sub(y1) - y0);
+}
+
+static inline int coord_ok(int v) {
+    return v >= -RASTER_MAX_COORD && v <= RASTER_MAX_COORD;
+}
+
+void fill_polygon(const point_t *pts, int n, uint8_t r, uint8_t g, uint8_t b) {
+    static point_t v[RASTER_MAX_POINTS];
+    if (n < 3 || n > RASTER_MAX_POINTS) return;
+    for (int i = 0; i < n; i++) {
+        if (!coord_ok(pts[i].x) || !coord_ok(pts[i].y)) return;
+        v[i].x = pts[i].x * SUB;
+        v[i].y = pts[i].y * SUB;
+    }
+    scan_polygon(v, n, fb_ops->color(r, g, b));
+    damage_points(v, n);
+}
+
+/* ——— Lines ——— */
+
+/* one pixel wide: Bresenham, each row's pixels go out as one span */
+static void thin_line(int x0, int y0, int x1, int y1, uint32_t color) {
+    int dx = (x1 > x0) ? x1 - x0 : x0 - x1;
+    int dy = (y1 > y0) ? y1 - y0 : y0 - y1;
+    int sx = (x0 < x1) ? 1 : -1;
+    int sy = (y0 < y1) ? 1 : -1;
+    int err = dx - dy;
+    int run_x = x0, run_y = y0, last_x = x0;
+
+    while (1) {
+        if (y0 != run_y) {
+            fb_span(run_y, run_x < last_x ? run_x : last_x, (run_x > last_x ? run_x : last_x) + 1, color);
+            run_x = x0;
+            run_y = y0;
+        }
+        last_x = x0;
+        if (x0 == x1 && y0 == y1) break;
+        int e2 = 2 * err;
+        if (e2 > -dy) { err -= dy; x0 += sx; }
+        if (e2 < dx)  { err += dx; y0 += sy; }
+    }
+    fb_span(run_y, run_x < last_x ? run_x : last_x, (run_x > last_x ? run_x : last_x) + 1, color);
+}
+
+/* width pixels wide with square caps: the rectangle around the segment
+   between the pixel centres, grown by width / 2 at both ends */
+static void thick_line(int x0, int y0, int x1, int y1, uint32_t color, int width) {
+    int64_t dx = x1 - x0, dy = y1 - y0;
+    int64_t half = (int64_t)width * SUB / 2;
+    int32_t len = (int32_t)isqrt64((uint64_t)(dx * dx + dy * dy) << 16);   /* length * 256 */
+    int ux, uy;     /* along the line, width / 2 long, 1/SUB pixel */
+    if (!len) {
+        ux = (int)half;
+        uy = 0;
+    } else {
+        ux = div_floor(dx * half * 256 + len / 2, len);
+        uy = div_floor(dy * half * 256 + len / 2, len);
+    }
+    int ax = x0 * SUB + HALF, ay = y0 * SUB + HALF;
+    int bx = x1 * SUB + HALF, by = y1 * SUB + HALF;
+    point_t quad[4] = {
+        { ax - ux - uy, ay - uy + ux },
+        { bx + ux - uy, by + uy + ux },
+        { bx + ux + uy, by + uy - ux },
+        { ax - ux + uy, ay - uy - ux },
+    };
+    scan_polygon(quad, 4, color);
+    damage_points(quad, 4);
+}
+
+void line(int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b, int width) {
+    if (!coord_ok(x0) || !coord_ok(y0) || !coord_ok(x1) || !coord_ok(y1) || width > RASTER_MAX_COORD)
+        return;
+    int pad = width / 2 + 1;
+    int lx = (x0 < x1 ? x0 : x1) - pad, ly = (y0 < y1 ? y0 : y1) - pad;
+    int hx = (x0 > x1 ? x0 : x1) + pad, hy = (y0 > y1 ? y0 : y1) + pad;
+    if (!on_screen(lx, ly, hx, hy)) return;
+
+    uint32_t color = fb_ops->color(r, g, b);
+    if (width > 1) {
+        thick_line(x0, y0, x1, y1, color, width);
+        return;
+    }
+    thin_line(x0, y0, x1, y1, color);
+    fb_damage(lx + pad, ly + pad, hx - lx - 2 * pad + 1, hy - ly - 2 * pad + 1);
+}
+
+void polygon(const point_t *pts, int n, uint8_t r, uint8_t g, uint8_t b, int width) {
+    if (n < 2 || n > RASTER_MAX_POINTS) return;
+    for (int i = 0; i < n; i++) {
+        const point_t *p = &pts[i], *q = &pts[i + 1 == n ? 0 : i + 1];
+        line(p->x, p->y, q->x, q->y, r, g, b, width);
+    }
+}
+
+/* ——— Ellipses ——— */
+
+static void ellipse_spans(int cx, int cy, int rx, int ry, uint32_t color, int filled) {
+    if (rx < 0 || ry < 0 || rx > RASTER_MAX_RADIUS || ry > RASTER_MAX_RADIUS) return;
+    if (!coord_ok(cx) || !coord_ok(cy)) return;
+    if (!on_screen(cx - rx, cy - ry, cx + rx, cy + ry)) return;
+
+    /* (dx, dy) is in when 4 dx^2 B + 4 dy^2 A <= A B */
+    int64_t a = (int64_t)(2 * rx + 1) * (2 * rx + 1);
+    int64_t b = (int64_t)(2 * ry + 1) * (2 * ry + 1);
+    int64_t ab = a * b;
+    int w = rx;     /* half width of row dy */
+
+    for (int dy = 0; dy <= ry; dy++) {
+        /* half width of the next row out, -1 past the end */
+        int next = w;
+        int64_t row = 4 * (int64_t)(dy + 1) * (dy + 1) * a;
+        if (dy == ry) next = -1;
+        else while (next >= 0 && 4 * (int64_t)next * next * b + row > ab) next--;
+
+        int inner = filled ? 0 : next + 1;     /* outline: down to where the next row ends */
+        if (inner > w) inner = w;
+        for (int side = 0; side < (dy ? 2 : 1); side++) {
+            int y = side ? cy - dy : cy + dy;
+            if (inner <= 0) {
+                fb_span(y, cx - w, cx + w + 1, color);
+            } else {
+                fb_span(y, cx - w, cx - inner + 1, color);
+                fb_span(y, cx + inner, cx + w + 1, color);
+            }
+        }
+        w = next;
+    }
+    fb_damage(cx - rx, cy - ry, 2 * rx + 1, 2 * ry + 1);
+}
+
+void circle(int cx, int cy, int radius, uint8_t r, uint8_t g, uint8_t b) {
+    ellipse_spans(cx, cy, radius, radius, fb_ops->color(r, g, b), 0);
+}
+
+void fill_circle(int cx, int cy, int radius, uint8_t r, uint8_t g, uint8_t b) {
+    ellipse_spans(cx, cy, radius, radius, fb_ops->color(r, g, b), 1);
+}
+
+void ellipse(int cx, int cy, int rx, int ry, uint8_t r, uint8_t g, uint8_t b) {
+    ellipse_spans(cx, cy, rx, ry, fb_ops->color(r, g, b), 0);
+}
+
+void fill_ellipse(int cx, int cy, int rx, int ry, uint8_t r, uint8_t g, uint8_t b) {
+    ellipse_spans(cx, cy, rx, ry, fb_ops->color(r, g, b), 1);
+}
@@ -0,0 +1,274 @@
+// modules/video/surface.c -- blits, colour-keyed blits and alpha blending
+//
+// Everything is clipped to both surfaces first and then done a row at a
+// time. Same-format copies are fb_ops->blit (memcpy per row); the keyed
+// copy and the blend have row kernels in two versions, plain C and SSE2
+// doing four pixels at a time, picked by the alternatives at boot.
+//
+// Blending is straight (not premultiplied) alpha, per channel
+//     t = s * a + d * (255 - a) + 128,  out = (t + (t >> 8)) >> 8
+// which is s * a / 255 + d * (255 - a) / 255 rounded, exact for a = 0 and
+// a = 255. The alpha byte is the same formula with s = 255, so it comes out
+// a + d * (255 - a) / 255 (source over). Both kernels compute exactly this.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <vesa.h>
+#include <surface.h>
+#include <heap.h>
+#include <slab.h>
+#include <cpu.h>
+
+extern mode_info_t vesa_mode_info;
+
+typedef uint32_t __attribute__((may_alias)) pix_word_t;
+
+static surface_t screen;
+static kmem_cache_t *surface_cache;
+
+surface_t *surface_screen(void) {
+    screen.pixels = fb_target();
+    screen.pitch = vesa_mode_info.BytesPerScanLine;
+    screen.width = vesa_mode_info.XResolution;
+    screen.height = vesa_mode_info.YResolution;
+    screen.format = fb_ops;
+    return &screen;
+}
+
+surface_t *surface_create(int w, int h, const fb_ops_t *format) {
+    if (w <= 0 || h <= 0 || !format->bytes) return NULL;
+    if (!surface_cache) surface_cache = kmem_cache_create("surface", sizeof(surface_t), 0, NULL);
+    surface_t *s = surface_cache ? kmem_cache_alloc(surface_cache) : NULL;
+    if (!s) return NULL;
+    /* rows padded to 16 bytes, the SSE2 kernels like them aligned */
+    s->pitch = ((size_t)w * format->bytes + 15) & ~(size_t)15;
+    s->pixels = aligned_alloc(16, s->pitch * (size_t)h);
+    if (!s->pixels) {
+        kmem_cache_free(surface_cache, s);
+        return NULL;
+    }
+    s->width = w;
+    s->height = h;
+    s->format = format;
+    return s;
+}
+
+void surface_destroy(surface_t *s) {
+    if (!s) return;
+    free(s->pixels);
+    kmem_cache_free(surface_cache, s);
+}
+
+/* clip the w x h rectangle at (sx, sy) in src going to (dx, dy) in dst
+   against both; 0 when nothing is left */
+static int clip(const surface_t *dst, int *dx, int *dy, const surface_t *src,
+                int *sx, int *sy, int *w, int *h) {
+    int d;
+    if (*sx < 0) { *dx -= *sx; *w += *sx; *sx = 0; }
+    if (*sy < 0) { *dy -= *sy; *h += *sy; *sy = 0; }
+    if (*dx < 0) { *sx -= *dx; *w += *dx; *dx = 0; }
+    if (*dy < 0) { *sy -= *dy; *h += *dy; *dy = 0; }
+    if ((d = *sx + *w - src->width) > 0) *w -= d;
+    if ((d = *sy + *h - src->height) > 0) *h -= d;
+    if ((d = *dx + *w - dst->width) > 0) *w -= d;
+    if ((d = *dy + *h - dst->height) > 0) *h -= d;
+    return *w > 0 && *h > 0;
+}
+
+static inline uint8_t *at(const surface_t *s, int x, int y) {
+    return s->pixels + (size_t)y * s->pitch + (size_t)x * s->format->bytes;
+}
+
+static inline void damage(const surface_t *dst, int x, int y, int w, int h) {
+    if (dst->pixels == fb_target()) fb_damage(x, y, w, h);
+}
+
+static inline int is_rgb32(const fb_ops_t *f) {
+    return f == &fb_xrgb8888 || f == &fb_argb8888;
+}
+
+/* src pixels can go into dst as they are (argb into xrgb just keeps its
+   alpha in the unused byte) */
+static inline int same_pixels(const fb_ops_t *src, const fb_ops_t *dst) {
+    return src == dst || (src == &fb_argb8888 && dst == &fb_xrgb8888);
+}
+
+/* ——— Row kernels ——— */
+
+ALT_IMPL static void key_row_c(uint32_t *dst, const uint32_t *src, size_t n, uint32_t key) {
+    for (size_t i = 0; i < n; i++)
+        if (src[i] != key) dst[i] = src[i];
+}
+
+/* dst = src where src != key: compare four pixels, merge through the mask */
+ALT_IMPL SSE2_FN static void key_row_sse2(uint32_t *dst, const uint32_t *src, size_t n, uint32_t key) {
+    size_t chunks = n / 4;
+    if (chunks) {
+        __asm__ volatile (
+            "movd %3, %%xmm3\n\t"
+            "pshufd $0, %%xmm3, %%xmm3\n\t"
+            "1:\n\t"
+            "movdqu (%1), %%xmm0\n\t"       /* src */
+            "movdqu (%0), %%xmm1\n\t"       /* dst */
+            "movdqa %%xmm0, %%xmm2\n\t"
+            "pcmpeqd %%xmm3, %%xmm2\n\t"    /* ones where src == key */
+            "pand %%xmm2, %%xmm1\n\t"
+            "pandn %%xmm0, %%xmm2\n\t"
+            "por %%xmm2, %%xmm1\n\t"
+            "movdqu %%xmm1, (%0)\n\t"
+            "add $16, %0\n\t"
+            "add $16, %1\n\t"
+            "dec %2\n\t"
+            "jnz 1b"
+            : "+r"(dst), "+r"(src), "+r"(chunks)
+            : "r"(key)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+    }
+    key_row_c(dst, src, n & 3, key);
+}
+
+void key_row32(uint32_t *dst, const uint32_t *src, size_t n, uint32_t key);
+ALT_ENTRY(key_row32, key_row_c);
+ALTERNATIVE(key_row32, key_row_sse2, CPU_SSE2);
+
+static inline uint32_t blend_channel(uint32_t s, uint32_t d, uint32_t a) {
+    uint32_t t = s * a + d * (255 - a) + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+ALT_IMPL static void blend_row_c(uint32_t *dst, const uint32_t *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        uint32_t s = src[i], d = dst[i], a = s >> 24;
+        if (a == 255) { dst[i] = s; continue; }
+        if (a == 0) continue;
+        dst[i] = blend_channel(s & 0xFF, d & 0xFF, a) |
+                 blend_channel(s >> 8 & 0xFF, d >> 8 & 0xFF, a) << 8 |
+                 blend_channel(s >> 16 & 0xFF, d >> 16 & 0xFF, a) << 16 |
+                 blend_channel(255, d >> 24, a) << 24;
+    }
+}
+
+static const uint16_t blend_255[8] __attribute__((aligned(16))) = { 255, 255, 255, 255, 255, 255, 255, 255 };
+static const uint16_t blend_128[8] __attribute__((aligned(16))) = { 128, 128, 128, 128, 128, 128, 128, 128 };
+static const uint16_t blend_opaque[8] __attribute__((aligned(16))) = { 0, 0, 0, 255, 0, 0, 0, 255 };
+
+/* four pixels a loop: widen to 16 bit lanes, two pixels per register, each
+   pixel's alpha copied to its four lanes with pshuflw/pshufhw, then the
+   source alpha lanes set to 255 for the output alpha */
+#define BLEND_HALF(unpack)                                                      \
+    "movdqa %%xmm0, %%xmm2\n\t"                                                 \
+    unpack " %%xmm7, %%xmm2\n\t"        /* s */                                 \
+    "movdqa %%xmm1, %%xmm3\n\t"                                                 \
+    unpack " %%xmm7, %%xmm3\n\t"        /* d */                                 \
+    "pshuflw $0xFF, %%xmm2, %%xmm4\n\t"                                         \
+    "pshufhw $0xFF, %%xmm4, %%xmm4\n\t" /* a */                                 \
+    "por %5, %%xmm2\n\t"                /* source alpha 255 */                  \
+    "movdqa %3, %%xmm5\n\t"                                                     \
+    "psubw %%xmm4, %%xmm5\n\t"          /* 255 - a */                           \
+    "pmullw %%xmm4, %%xmm2\n\t"                                                 \
+    "pmullw %%xmm5, %%xmm3\n\t"                                                 \
+    "paddw %%xmm3, %%xmm2\n\t"                                                  \
+    "paddw %4, %%xmm2\n\t"              /* t */                                 \
+    "movdqa %%xmm2, %%xmm3\n\t"                                                 \
+    "psrlw $8, %%xmm3\n\t"                                                      \
+    "paddw %%xmm3, %%xmm2\n\t"                                                  \
+    "psrlw $8, %%xmm2\n\t"
+
+ALT_IMPL SSE2_FN static void blend_row_sse2(uint32_t *dst, const uint32_t *src, size_t n) {
+    size_t chunks = n / 4;
+    if (chunks) {
+        __asm__ volatile (
+            "pxor %%xmm7, %%xmm7\n\t"
+            "1:\n\t"
+            "movdqu (%1), %%xmm0\n\t"
+            "movdqu (%0), %%xmm1\n\t"
+            BLEND_HALF("punpckhbw")
+            "movdqa %%xmm2, %%xmm6\n\t"     /* high pixels done, park them */
+            BLEND_HALF("punpcklbw")
+            "packuswb %%xmm6, %%xmm2\n\t"
+            "movdqu %%xmm2, (%0)\n\t"
+            "add $16, %0\n\t"
+            "add $16, %1\n\t"
+            "dec %2\n\t"
+            "jnz 1b"
+            : "+r"(dst), "+r"(src), "+r"(chunks)
+            : "m"(blend_255), "m"(blend_128), "m"(blend_opaque)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "memory", "cc");
+    }
+    blend_row_c(dst, src, n & 3);
+}
+
+void blend_row32(uint32_t *dst, const uint32_t *src, size_t n);
+ALT_ENTRY(blend_row32, blend_row_c);
+ALTERNATIVE(blend_row32, blend_row_sse2, CPU_SSE2);
+
+/* ——— Operations ——— */
+
+/* one row of 32 bit rgb converted to dst's format; with key, those are
+   skipped, with blend the ones under alpha 128 */
+static void convert_row(uint8_t *dst, const fb_ops_t *f, const pix_word_t *src, int n,
+                        int keyed, uint32_t key, int blend) {
+    for (int i = 0; i < n; i++, dst += f->bytes) {
+        uint32_t s = src[i];
+        if ((keyed && s == key) || (blend && s >> 24 < 128)) continue;
+        f->pixel(dst, f->color((uint8_t)(s >> 16), (uint8_t)(s >> 8), (uint8_t)s));
+    }
+}
+
+void surface_blit(surface_t *dst, int dx, int dy, const surface_t *src, int sx, int sy, int w, int h) {
+    if (!clip(dst, &dx, &dy, src, &sx, &sy, &w, &h)) return;
+    uint8_t *d = at(dst, dx, dy);
+    const uint8_t *s = at(src, sx, sy);
+    if (same_pixels(src->format, dst->format)) {
+        dst->format->blit(d, dst->pitch, s, src->pitch, w, h);
+    } else if (is_rgb32(src->format)) {
+        for (int y = 0; y < h; y++, d += dst->pitch, s += src->pitch)
+            convert_row(d, dst->format, (const pix_word_t*)s, w, 0, 0, 0);
+    } else {
+        return;
+    }
+    damage(dst, dx, dy, w, h);
+}
+
+void surface_blit_key(surface_t *dst, int dx, int dy, const surface_t *src, int sx, int sy,
+                      int w, int h, uint32_t key) {
+    if (!clip(dst, &dx, &dy, src, &sx, &sy, &w, &h)) return;
+    uint8_t *d = at(dst, dx, dy);
+    const uint8_t *s = at(src, sx, sy);
+    size_t bytes = dst->format->bytes;
+    if (same_pixels(src->format, dst->format) && bytes == 4) {
+        for (int y = 0; y < h; y++, d += dst->pitch, s += src->pitch)
+            key_row32((uint32_t*)d, (const uint32_t*)s, (size_t)w, key);
+    } else if (src->format == dst->format) {
+        /* 16 and 24 bit: compare the pixel's bytes */
+        for (int y = 0; y < h; y++, d += dst->pitch, s += src->pitch) {
+            for (int x = 0; x < w; x++) {
+                const uint8_t *p = s + (size_t)x * bytes;
+                uint32_t v = bytes == 2 ? (uint32_t)(p[0] | p[1] << 8) : (uint32_t)(p[0] | p[1] << 8 | p[2] << 16);
+                if (v != key) dst->format->pixel(d + (size_t)x * bytes, v);
+            }
+        }
+    } else if (is_rgb32(src->format)) {
+        for (int y = 0; y < h; y++, d += dst->pitch, s += src->pitch)
+            convert_row(d, dst->format, (const pix_word_t*)s, w, 1, key, 0);
+    } else {
+        return;
+    }
+    damage(dst, dx, dy, w, h);
+}
+
+void surface_blend(surface_t *dst, int dx, int dy, const surface_t *src, int sx, int sy, int w, int h) {
+    if (src->format != &fb_argb8888) return;
+    if (!clip(dst, &dx, &dy, src, &sx, &sy, &w, &h)) return;
+    uint8_t *d = at(dst, dx, dy);
+    const uint8_t *s = at(src, sx, sy);
+    if (is_rgb32(dst->format)) {
+        for (int y = 0; y < h; y++, d += dst->pitch, s += src->pitch)
+            blend_row32((uint32_t*)d, (const uint32_t*)s, (size_t)w);
+    } else {
+        for (int y = 0; y < h; y++, d += dst->pitch, s += src->pitch)
+            convert_row(d, dst->format, (const pix_word_t*)s, w, 0, 0, 1);
+    }
+    damage(dst, dx, dy, w, h);
+}
@@ -1,98 +1,329 @@
 #include <vesa.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <asm.h>
+#include <heap.h>
+#include <dispi.h>
 
 extern mode_info_t vesa_mode_info;
 
-static inline void put_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
-    if (x < 0 || x >= vesa_mode_info.XResolution || y < 0 || y >= vesa_mode_info.YResolution)
-        return;
+/* ——— Shadow framebuffer ———
+ * With fb_shadow_init() all drawing goes to a copy of the screen in RAM and
+ * every primitive records the rectangle it touched. fb_flush() copies just
+ * those rectangles to video memory, which is uncached or write-combined and
+ * terrible to read from. Without a shadow everything draws straight to VRAM
+ * and the damage calls are no-ops.
+ *
+ * Damage is a short list of rectangles (exclusive x1/y1). A new one is merged
+ * into any rectangle it overlaps or touches when the union wastes little, so
+ * a line of text ends up as one rectangle; once the list is full it goes into
+ * whichever rectangle grows least.
+ *
+ * With fb_pages_init() video memory holds several screens' worth of rows
+ * and the scanout starts at row `shown`. fb_flush() copies the damage into
+ * a window that does not overlap the visible one and then flips to it, so
+ * nothing on screen is ever half drawn. That window is the previous page
+ * when it is still around, short only what the last flush copied (`last`);
+ * otherwise it gets the whole screen. A scroll of the whole screen shifts
+ * the pending damage, adds the rows that came in at the bottom and moves the
+ * next scanout down by as many rows: the moved pixels are already in video
+ * memory. Once the window runs into the end everything goes to a fresh page.
+ */
+#define FB_DAMAGE_MAX   16
+#define FB_MERGE_SLACK  (64 * 64)   /* undamaged pixels a merge may drag in */
+
+typedef struct {
+    int x0, y0, x1, y1;
+} fb_rect_t;
+
+static uint8_t *shadow = NULL;
+static fb_rect_t damage[FB_DAMAGE_MAX];
+static int damage_count = 0;
+static volatile int flushing = 0;
+
+static int vram_rows = 0;           /* 0: one page, no flipping */
+static int shown = 0;               /* first row scanned out */
+static int spare = -1;              /* the page before, -1 if gone */
+static int scrolled = 0;            /* rows scrolled up since the last flush */
+static fb_rect_t last[FB_DAMAGE_MAX];
+static int last_count = 0;
+
+static inline uint8_t *vram(void) {
+    return (uint8_t*)(uintptr_t)vesa_mode_info.PhysBasePtr;
+}
+
+uint8_t *fb_target(void) {
+    return shadow ? shadow : vram();
+}
+
+void fb_shadow_init(void) {
+    if (shadow || !vesa_mode_info.PhysBasePtr) return;
+    size_t bytes = (size_t)vesa_mode_info.BytesPerScanLine * vesa_mode_info.YResolution;
+    uint8_t *buf = aligned_alloc(64, bytes);
+    if (!buf) return;   /* keep drawing to VRAM */
+    /* the one read from video memory */
+    memcpy(buf, vram(), bytes);
+    shadow = buf;
+}
+
+int fb_pages_init(void) {
+    int height = vesa_mode_info.YResolution;
+    size_t pitch = vesa_mode_info.BytesPerScanLine;
+    if (!shadow || vram_rows || !height || !pitch) return vram_rows;
+    /* paging maps only the first screen when the BIOS did not say how
+       much video memory there is, so the other pages would fault */
+    if (!vesa_vram_bytes) return 0;
+
+    size_t rows = vesa_vram_bytes / pitch;
+    if (rows > 0xFFFF) rows = 0xFFFF;
+    if (rows < (size_t)height * 2) return 0;
+    int got = dispi_init((int)rows);
+    if (got < height * 2) return 0;
+
+    uintptr_t flags = irq_save();
+    vram_rows = got;
+    shown = 0;
+    spare = -1;
+    irq_restore(flags);
+    return vram_rows;
+}
+
+static inline long rect_area(int x0, int y0, int x1, int y1) {
+    return (long)(x1 - x0) * (y1 - y0);
+}
+
+void fb_damage(int x, int y, int w, int h) {
+    if (!shadow) return;
 
-    uint8_t *fb = (uint8_t*)(uintptr_t)vesa_mode_info.PhysBasePtr;
-    size_t offset = y * vesa_mode_info.BytesPerScanLine + x * (vesa_mode_info.BitsPerPixel / 8);
-
-    switch (vesa_mode_info.BitsPerPixel) {
-        case 16: {
-            // Assume 5-5-5 RGB
-            uint16_t color16 = ((r >> 3) << vesa_mode_info.RedMaskPos) |
-                               ((g >> 3) << vesa_mode_info.GreenMaskPos) |
-                               ((b >> 3) << vesa_mode_info.BlueMaskPos);
-            *((uint16_t*)(fb + offset)) = color16;
-            break;
+    int x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+    int x1 = x + w, y1 = y + h;
+    if (x1 > vesa_mode_info.XResolution) x1 = vesa_mode_info.XResolution;
+    if (y1 > vesa_mode_info.YResolution) y1 = vesa_mode_info.YResolution;
+    if (x0 >= x1 || y0 >= y1) return;
+
+    uintptr_t flags = irq_save();
+    int best = -1;
+    long best_growth = 0;
+    for (int i = damage_count - 1; i >= 0; i--) {
+        fb_rect_t *d = &damage[i];
+        if (x0 >= d->x0 && y0 >= d->y0 && x1 <= d->x1 && y1 <= d->y1) {
+            irq_restore(flags);
+            return;     /* already covered */
         }
-        case 24: {
-            fb[offset + vesa_mode_info.RedMaskPos / 8]   = r;
-            fb[offset + vesa_mode_info.GreenMaskPos / 8] = g;
-            fb[offset + vesa_mode_info.BlueMaskPos / 8]  = b;
-            break;
+        int ux0 = d->x0 < x0 ? d->x0 : x0, uy0 = d->y0 < y0 ? d->y0 : y0;
+        int ux1 = d->x1 > x1 ? d->x1 : x1, uy1 = d->y1 > y1 ? d->y1 : y1;
+        long growth = rect_area(ux0, uy0, ux1, uy1) - rect_area(d->x0, d->y0, d->x1, d->y1)
+                    - rect_area(x0, y0, x1, y1);
+        int touches = x0 <= d->x1 && d->x0 <= x1 && y0 <= d->y1 && d->y0 <= y1;
+        if ((touches && growth <= FB_MERGE_SLACK) || damage_count == FB_DAMAGE_MAX) {
+            if (best < 0 || growth < best_growth) {
+                best = i;
+                best_growth = growth;
+            }
         }
-        case 32: {
-            uint32_t color32 = (r << vesa_mode_info.RedMaskPos) |
-                               (g << vesa_mode_info.GreenMaskPos) |
-                               (b << vesa_mode_info.BlueMaskPos);
-            *((uint32_t*)(fb + offset)) = color32;
-            break;
+    }
+
+    if (best >= 0) {
+        fb_rect_t *d = &damage[best];
+        if (x0 < d->x0) d->x0 = x0;
+        if (y0 < d->y0) d->y0 = y0;
+        if (x1 > d->x1) d->x1 = x1;
+        if (y1 > d->y1) d->y1 = y1;
+    } else {
+        damage[damage_count++] = (fb_rect_t){ x0, y0, x1, y1 };
+    }
+    irq_restore(flags);
+}
+
+/* plain integer copy: fb_flush() runs from the timer interrupt, and rep
+   movs is all write-combined video memory needs */
+static inline void copy_span(uint8_t *dst, const uint8_t *src, size_t n) {
+    size_t words = n / 4, rest = n & 3;
+    __asm__ volatile ("rep movsl" : "+D"(dst), "+S"(src), "+c"(words) : : "memory");
+    __asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(rest) : : "memory");
+}
+
+/* the rects from the shadow into the page starting at row top */
+static void copy_rects(int top, const fb_rect_t *rects, int n) {
+    size_t pitch = vesa_mode_info.BytesPerScanLine;
+    size_t bpp = (vesa_mode_info.BitsPerPixel + 7) / 8;
+    uint8_t *out = vram() + (size_t)top * pitch;
+    for (int i = 0; i < n; i++) {
+        const fb_rect_t *r = &rects[i];
+        size_t offset = (size_t)r->y0 * pitch + (size_t)r->x0 * bpp;
+        size_t span = (size_t)(r->x1 - r->x0) * bpp;
+        if (r->x0 == 0 && r->x1 == vesa_mode_info.XResolution) {
+            /* full width: the rows are contiguous, one copy */
+            copy_span(out + offset, shadow + offset, (size_t)(r->y1 - r->y0) * pitch);
+            continue;
         }
+        for (int y = r->y0; y < r->y1; y++, offset += pitch)
+            copy_span(out + offset, shadow + offset, span);
     }
 }
 
-void set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
-    put_pixel(x, y, r, g, b);
+void fb_flush(void) {
+    if (!shadow || flushing) return;
+    flushing = 1;
+
+    fb_rect_t rects[FB_DAMAGE_MAX];
+    uintptr_t flags = irq_save();
+    int n = damage_count;
+    int moved = scrolled;
+    memcpy(rects, damage, (size_t)n * sizeof(fb_rect_t));
+    damage_count = 0;
+    scrolled = 0;
+    irq_restore(flags);
+
+    if (!vram_rows) {
+        copy_rects(0, rects, n);
+        flushing = 0;
+        return;
+    }
+
+    int height = vesa_mode_info.YResolution;
+    const fb_rect_t screen = { 0, 0, vesa_mode_info.XResolution, height };
+    if (moved) {
+        if (shown + moved + height <= vram_rows) {
+            /* the rows that scrolled are already there, one row further down */
+            shown += moved;
+            copy_rects(shown, rects, n);
+            dispi_set_y_offset(shown);
+            spare = -1;
+            flushing = 0;
+            return;
+        }
+        rects[0] = screen;
+        n = 1;
+        spare = -1;
+    }
+    if (!n) {
+        flushing = 0;
+        return;
+    }
+
+    int back = shown >= height ? 0 : shown + 2 * height <= vram_rows ? shown + height : -1;
+    if (back < 0) {
+        /* only after scrolling with less than three pages: no room to flip */
+        copy_rects(shown, rects, n);
+        spare = -1;
+        flushing = 0;
+        return;
+    }
+    if (back == spare) {
+        copy_rects(back, last, last_count);
+    } else {
+        rects[0] = screen;
+        n = 1;
+    }
+    copy_rects(back, rects, n);
+    dispi_set_y_offset(back);
+    memcpy(last, rects, (size_t)n * sizeof(fb_rect_t));
+    last_count = n;
+    spare = shown;
+    shown = back;
+    flushing = 0;
 }
 
-void draw_hline(int x, int y, int w, uint8_t r, uint8_t g, uint8_t b) {
-    for (int i = 0; i < w; i++) set_pixel(x + i, y, r, g, b);
+uint32_t vesa_color(uint8_t r, uint8_t g, uint8_t b) {
+    return fb_ops->color(r, g, b);
 }
 
-void draw_vline(int x, int y, int h, uint8_t r, uint8_t g, uint8_t b) {
-    for (int i = 0; i < h; i++) set_pixel(x, y + i, r, g, b);
+/* color is native */
+static inline void put_pixel(int x, int y, uint32_t color) {
+    if (x < 0 || x >= vesa_mode_info.XResolution || y < 0 || y >= vesa_mode_info.YResolution)
+        return;
+    fb_ops->pixel(fb_target() + (size_t)y * vesa_mode_info.BytesPerScanLine + (size_t)x * fb_ops->bytes, color);
 }
 
-void rectangle(int x, int y, int w, int h, uint8_t r, uint8_t g, uint8_t b) {
-    for (int j = 0; j < h; j++) draw_hline(x, y + j, w, r, g, b);
+void set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
+    put_pixel(x, y, fb_ops->color(r, g, b));
+    fb_damage(x, y, 1, 1);
 }
 
-void line(int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b, int width) {
-    int dx = (x1 > x0) ? x1 - x0 : x0 - x1;
-    int dy = (y1 > y0) ? y1 - y0 : y0 - y1;
-    int sx = (x0 < x1) ? 1 : -1;
-    int sy = (y0 < y1) ? 1 : -1;
-    int err = dx - dy;
+/* clip to the screen, fill, report the damage once */
+static void fill_rect(int x, int y, int w, int h, uint8_t r, uint8_t g, uint8_t b) {
+    int x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+    int x1 = x + w, y1 = y + h;
+    if (x1 > vesa_mode_info.XResolution) x1 = vesa_mode_info.XResolution;
+    if (y1 > vesa_mode_info.YResolution) y1 = vesa_mode_info.YResolution;
+    if (x0 >= x1 || y0 >= y1) return;
 
-    while (1) {
-        for (int wx = -width/2; wx <= width/2; wx++)
-            for (int wy = -width/2; wy <= width/2; wy++)
-                set_pixel(x0 + wx, y0 + wy, r, g, b);
+    uint32_t color = fb_ops->color(r, g, b);
+    size_t pitch = vesa_mode_info.BytesPerScanLine;
+    size_t bpp = fb_ops->bytes;
+    size_t span = (size_t)(x1 - x0);
+    uint8_t *row = fb_target() + (size_t)y0 * pitch + (size_t)x0 * bpp;
 
-        if (x0 == x1 && y0 == y1) break;
-        int e2 = 2 * err;
-        if (e2 > -dy) { err -= dy; x0 += sx; }
-        if (e2 < dx)  { err += dx; y0 += sy; }
+    if (span * bpp == pitch) {
+        /* full rows without padding: one run */
+        fb_ops->span(row, color, span * (size_t)(y1 - y0));
+    } else {
+        for (int yy = y0; yy < y1; yy++, row += pitch)
+            fb_ops->span(row, color, span);
     }
+    fb_damage(x0, y0, x1 - x0, y1 - y0);
 }
 
-void clear_screen(uint8_t r, uint8_t g, uint8_t b) {
-    for (int y = 0; y < vesa_mode_info.YResolution; y++) {
-        for (int x = 0; x < vesa_mode_info.XResolution; x++)
-            set_pixel(x, y, r, g, b);
-    }
+void draw_hline(int x, int y, int w, uint8_t r, uint8_t g, uint8_t b) {
+    fill_rect(x, y, w, 1, r, g, b);
+}
+
+void draw_vline(int x, int y, int h, uint8_t r, uint8_t g, uint8_t b) {
+    fill_rect(x, y, 1, h, r, g, b);
 }
 
-void circle(int cx, int cy, int radius, uint8_t r, uint8_t g, uint8_t b) {
-    int x = radius, y = 0;
-    int err = 0;
+void rectangle(int x, int y, int w, int h, uint8_t r, uint8_t g, uint8_t b) {
+    fill_rect(x, y, w, h, r, g, b);
+}
+
+void fb_span(int y, int x0, int x1, uint32_t color) {
+    if (y < 0 || y >= vesa_mode_info.YResolution) return;
+    if (x0 < 0) x0 = 0;
+    if (x1 > vesa_mode_info.XResolution) x1 = vesa_mode_info.XResolution;
+    if (x0 >= x1) return;
+    fb_ops->span(fb_target() + (size_t)y * vesa_mode_info.BytesPerScanLine + (size_t)x0 * fb_ops->bytes,
+                 color, (size_t)(x1 - x0));
+}
 
-    while (x >= y) {
-        set_pixel(cx + x, cy + y, r, g, b);
-        set_pixel(cx + y, cy + x, r, g, b);
-        set_pixel(cx - y, cy + x, r, g, b);
-        set_pixel(cx - x, cy + y, r, g, b);
-        set_pixel(cx - x, cy - y, r, g, b);
-        set_pixel(cx - y, cy - x, r, g, b);
-        set_pixel(cx + y, cy - x, r, g, b);
-        set_pixel(cx + x, cy - y, r, g, b);
+void vesa_move_rows(int dst_y, int src_y, int count) {
+    int height = vesa_mode_info.YResolution;
+    if (dst_y < 0 || src_y < 0 || count <= 0) return;
+    if (dst_y + count > height) count = height - dst_y;
+    if (src_y + count > height) count = height - src_y;
+    if (count <= 0 || dst_y == src_y) return;
 
-        y++;
-        if (err <= 0) err += 2*y + 1;
-        if (err > 0)  { x--; err -= 2*x + 1; }
+    /* scrolling up from the top with pages: the next flush moves the
+       scanout, so what is pending moves up with the pixels and only the rows
+       below the moved ones need copying. No flush may run in between */
+    int hw = vram_rows && !flushing && dst_y == 0 && height - count < count;
+    if (hw) flushing = 1;
+
+    /* whole scanlines, pitch padding included: one contiguous move */
+    uint8_t *fb = fb_target();
+    size_t pitch = vesa_mode_info.BytesPerScanLine;
+    memmove(fb + (size_t)dst_y * pitch, fb + (size_t)src_y * pitch, (size_t)count * pitch);
+
+    if (hw) {
+        uintptr_t flags = irq_save();
+        int kept = 0;
+        for (int i = 0; i < damage_count; i++) {
+            fb_rect_t d = damage[i];
+            d.y0 = d.y0 > src_y ? d.y0 - src_y : 0;
+            d.y1 -= src_y;
+            if (d.y1 > d.y0) damage[kept++] = d;
+        }
+        damage_count = kept;
+        scrolled += src_y;
+        irq_restore(flags);
+        flushing = 0;
+        fb_damage(0, count, vesa_mode_info.XResolution, height - count);
+        return;
     }
+    fb_damage(0, dst_y, vesa_mode_info.XResolution, count);
+}
+
+void clear_screen(uint8_t r, uint8_t g, uint8_t b) {
+    fill_rect(0, 0, vesa_mode_info.XResolution, vesa_mode_info.YResolution, r, g, b);
 }
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <function.h>
+#include <heap.h>
 #include <cyrillic.h>
 
 static record_func_t* functions = NULL;
@@ -13,21 +14,22 @@ static size_t function_capacity = 0;
 function new_func(function source, const char* name) {
     // Initialize registry if needed
     if (!functions) {
-        function_capacity = FUNCTION_CAPACITY; // initial capacity
-        functions = (record_func_t*)malloc(sizeof(record_func_t) * function_capacity);
+        size_t bytes;
+        functions = (record_func_t*)malloc_sized(sizeof(record_func_t) * FUNCTION_CAPACITY, &bytes);
         if (!functions) {
             printf("[functions] Malloc failed\n");
         }
-        DEBUG_PRINT("[functions]: Allocated %u bytes\n", sizeof(record_func_t)*function_capacity);
+        DEBUG_PRINT("[functions]: Allocated %u bytes\n", bytes);
         if (!functions) return NULL;
+        function_capacity = bytes / sizeof(record_func_t); // use all of the block
     }
 
-    // Grow array if needed
+    // Grow array if needed (realloc extends in place when it can)
     if (function_count == function_capacity) {
-        function_capacity *= 2;
-        record_func_t* tmp = (record_func_t*)realloc(functions, sizeof(record_func_t) * function_capacity);
+        record_func_t* tmp = (record_func_t*)realloc(functions, sizeof(record_func_t) * function_capacity * 2);
         if (!tmp) return NULL;
         functions = tmp;
+        function_capacity = malloc_usable_size(functions) / sizeof(record_func_t);
     }
 
     functions[function_count].func = source;
@@ -0,0 +1,411 @@
+// tests/hosted/bench.c -- micro-benchmarks for the kernel libc, run on the host
+//
+//   make bench                  everything
+//   tests/hosted/bench mem      just one suite (mem, str, malloc, printf)
+//   tests/hosted/bench 16 fill  at 16 (or 24) bpp instead of 32
+//
+// One line per measurement: suite, case, kernel figure, glibc figure for
+// scale. Numbers from one machine are only comparable with each other, the
+// point is to diff before/after a change.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vesa.h>
+#include <surface.h>
+#include <raster.h>
+
+#include "hosted.h"
+
+typedef void* (*memcpy_fn)(void*, const void*, size_t);
+typedef void* (*memset_fn)(void*, int, size_t);
+typedef size_t (*strlen_fn)(const char*);
+typedef char* (*strchr_fn)(const char*, int);
+typedef void* (*malloc_fn)(size_t);
+typedef void (*free_fn)(void*);
+
+/* through volatile pointers so the compiler cannot inline or drop the glibc calls */
+static memcpy_fn volatile libc_memcpy = memcpy;
+static memcpy_fn volatile libc_memmove = memmove;
+static memset_fn volatile libc_memset = memset;
+static strlen_fn volatile libc_strlen = strlen;
+static strchr_fn volatile libc_strchr = strchr;
+static malloc_fn volatile libc_malloc = malloc;
+static free_fn volatile libc_free = free;
+
+static volatile uintptr_t sink;
+
+static uint32_t rng = 0x12345678u;
+static uint32_t rnd(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/* repeat so every case moves about the same number of bytes */
+static size_t reps_for(size_t n) {
+    size_t reps = (size_t)(256u << 20) / (n + 64);
+    if (reps < 8) reps = 8;
+    if (reps > 4000000) reps = 4000000;
+    return reps;
+}
+
+static double mb_per_s(size_t bytes, uint64_t ns) {
+    return ns ? (double)bytes * 1000.0 / (double)ns : 0.0;
+}
+
+static const size_t mem_sizes[] = { 7, 16, 64, 256, 1024, 4096, 65536, 1u << 20, 8u << 20 };
+static const struct { size_t dst, src; } mem_align[] = { {0, 0}, {1, 0}, {3, 5}, {0, 7} };
+
+static void bench_mem(void) {
+    size_t max = (8u << 20) + 64;
+    unsigned char* src = malloc(max);
+    unsigned char* dst = malloc(max);
+    memset(src, 0x5A, max);
+    memset(dst, 0, max);
+
+    for (size_t i = 0; i < sizeof(mem_sizes) / sizeof(mem_sizes[0]); i++) {
+        size_t n = mem_sizes[i];
+        size_t reps = reps_for(n);
+        for (size_t a = 0; a < sizeof(mem_align) / sizeof(mem_align[0]); a++) {
+            unsigned char* d = dst + mem_align[a].dst;
+            unsigned char* s = src + mem_align[a].src;
+
+            uint64_t t0 = hosted_ns();
+            for (size_t r = 0; r < reps; r++) k_memcpy(d, s, n);
+            uint64_t t1 = hosted_ns();
+            for (size_t r = 0; r < reps; r++) libc_memcpy(d, s, n);
+            uint64_t t2 = hosted_ns();
+            printf("mem    memcpy  %8zu +%zu/+%zu  %10.1f MB/s  (glibc %10.1f)\n",
+                   n, mem_align[a].dst, mem_align[a].src,
+                   mb_per_s(n * reps, t1 - t0), mb_per_s(n * reps, t2 - t1));
+        }
+
+        uint64_t t0 = hosted_ns();
+        for (size_t r = 0; r < reps; r++) k_memset(dst + 1, (int)r, n);
+        uint64_t t1 = hosted_ns();
+        for (size_t r = 0; r < reps; r++) libc_memset(dst + 1, (int)r, n);
+        uint64_t t2 = hosted_ns();
+        printf("mem    memset  %8zu +1       %10.1f MB/s  (glibc %10.1f)\n",
+               n, mb_per_s(n * reps, t1 - t0), mb_per_s(n * reps, t2 - t1));
+
+        /* overlapping, dest above src: the backward path */
+        t0 = hosted_ns();
+        for (size_t r = 0; r < reps; r++) k_memmove(src + 3, src, n);
+        t1 = hosted_ns();
+        for (size_t r = 0; r < reps; r++) libc_memmove(src + 3, src, n);
+        t2 = hosted_ns();
+        printf("mem    memmove %8zu overlap  %10.1f MB/s  (glibc %10.1f)\n",
+               n, mb_per_s(n * reps, t1 - t0), mb_per_s(n * reps, t2 - t1));
+    }
+    free(src);
+    free(dst);
+}
+
+static void bench_str(void) {
+    static const size_t lens[] = { 3, 15, 64, 256, 4096, 65536 };
+    char* buf = malloc(65536 + 64);
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        size_t n = lens[i];
+        memset(buf, 'a', n);
+        buf[n] = 0;
+        size_t reps = reps_for(n);
+        uintptr_t acc = 0;
+
+        uint64_t t0 = hosted_ns();
+        for (size_t r = 0; r < reps; r++) acc += k_strlen(buf + (r & 1));
+        uint64_t t1 = hosted_ns();
+        for (size_t r = 0; r < reps; r++) acc += libc_strlen(buf + (r & 1));
+        uint64_t t2 = hosted_ns();
+        printf("str    strlen  %8zu          %10.1f MB/s  (glibc %10.1f)\n",
+               n, mb_per_s(n * reps, t1 - t0), mb_per_s(n * reps, t2 - t1));
+
+        t0 = hosted_ns();
+        for (size_t r = 0; r < reps; r++) acc += (uintptr_t)k_strchr(buf, 'z');
+        t1 = hosted_ns();
+        for (size_t r = 0; r < reps; r++) acc += (uintptr_t)libc_strchr(buf, 'z');
+        t2 = hosted_ns();
+        printf("str    strchr  %8zu miss     %10.1f MB/s  (glibc %10.1f)\n",
+               n, mb_per_s(n * reps, t1 - t0), mb_per_s(n * reps, t2 - t1));
+        sink = acc;
+    }
+    free(buf);
+}
+
+#define CHURN_SLOTS 4096
+#define CHURN_OPS   2000000
+
+/* mostly small objects, some page sized, a few big ones */
+static size_t churn_size(void) {
+    uint32_t r = rnd();
+    switch (r & 15) {
+        case 0:  return 4096 + (r >> 8) % 60000;
+        case 1: case 2: return 256 + (r >> 8) % 3840;
+        default: return 8 + (r >> 8) % 248;
+    }
+}
+
+static uint64_t churn(void* (*alloc)(size_t), void (*release)(void*)) {
+    static void* slots[CHURN_SLOTS];
+    memset(slots, 0, sizeof(slots));
+    rng = 0xC0FFEEu;
+
+    uint64_t t0 = hosted_ns();
+    for (uint32_t i = 0; i < CHURN_OPS; i++) {
+        uint32_t s = rnd() % CHURN_SLOTS;
+        if (slots[s]) {
+            release(slots[s]);
+            slots[s] = NULL;
+        } else {
+            slots[s] = alloc(churn_size());
+            if (slots[s]) *(volatile char*)slots[s] = 1;
+        }
+    }
+    for (uint32_t s = 0; s < CHURN_SLOTS; s++) release(slots[s]);
+    return hosted_ns() - t0;
+}
+
+static void bench_malloc(void) {
+    uint64_t k = churn(k_malloc, k_free);
+    uint64_t g = churn(libc_malloc, libc_free);
+    printf("malloc churn   %u ops  %8.1f ns/op  (glibc %8.1f)\n",
+           CHURN_OPS, (double)k / CHURN_OPS, (double)g / CHURN_OPS);
+
+    /* LIFO bursts of one size class, the slab-like pattern */
+    enum { BURST = 1024, ROUNDS = 2000 };
+    static void* burst[BURST];
+    uint64_t t0 = hosted_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BURST; i++) burst[i] = k_malloc(48);
+        for (int i = BURST - 1; i >= 0; i--) k_free(burst[i]);
+    }
+    uint64_t t1 = hosted_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BURST; i++) burst[i] = libc_malloc(48);
+        for (int i = BURST - 1; i >= 0; i--) libc_free(burst[i]);
+    }
+    uint64_t t2 = hosted_ns();
+    double ops = 2.0 * BURST * ROUNDS;
+    printf("malloc burst   48 B        %8.1f ns/op  (glibc %8.1f)\n",
+           (double)(t1 - t0) / ops, (double)(t2 - t1) / ops);
+
+    /* grow a buffer one byte at a time, realloc in place or not */
+    t0 = hosted_ns();
+    for (int r = 0; r < 20; r++) {
+        char* p = NULL;
+        for (size_t n = 1; n <= 65536; n++) {
+            p = k_realloc(p, n);
+            p[n - 1] = (char)n;
+        }
+        k_free(p);
+    }
+    t1 = hosted_ns();
+    printf("malloc realloc 1..64K      %8.1f ns/op\n", (double)(t1 - t0) / (20.0 * 65536));
+}
+
+static void bench_printf(void) {
+    enum { LINES = 2000 };
+    size_t chars = 0;
+    uint64_t t0 = hosted_ns();
+    for (int i = 0; i < LINES; i++)
+        chars += (size_t)k_printf("line %d: value=0x%08X name=%s %c\n", i, (unsigned)i * 2654435761u, "kernel", 'x');
+    fb_flush();
+    uint64_t t1 = hosted_ns();
+    printf("printf lines   %d         %8.1f ns/char  %8.1f us/line\n",
+           LINES, (double)(t1 - t0) / (double)chars, (double)(t1 - t0) / (1000.0 * LINES));
+
+    /* the same line over and over, no scroll: formatting plus glyphs */
+    chars = 0;
+    t0 = hosted_ns();
+    for (int i = 0; i < LINES; i++)
+        chars += (size_t)k_printf("\rline %d: value=0x%08X name=%s %c", i, (unsigned)i * 2654435761u, "kernel", 'x');
+    fb_flush();
+    t1 = hosted_ns();
+    printf("printf inline  %d         %8.1f ns/char\n", LINES, (double)(t1 - t0) / (double)chars);
+
+    /* formatting alone */
+    static char out[128];
+    chars = 0;
+    t0 = hosted_ns();
+    for (int i = 0; i < LINES * 10; i++)
+        chars += (size_t)k_snprintf(out, sizeof(out), "line %d: value=0x%08X name=%s %c\n", i, (unsigned)i * 2654435761u, "kernel", 'x');
+    t1 = hosted_ns();
+    printf("snprintf       %d         %8.1f ns/char\n", LINES * 10, (double)(t1 - t0) / (double)chars);
+
+    /* no newline, no scroll: glyph drawing on its own */
+    static char text[81];
+    memset(text, 'M', 80);
+    t0 = hosted_ns();
+    for (int i = 0; i < LINES; i++) {
+        k_printf("%s", text);
+    }
+    fb_flush();
+    t1 = hosted_ns();
+    printf("printf glyphs  %d chars  %8.1f ns/char\n", LINES * 80, (double)(t1 - t0) / (80.0 * LINES));
+
+    /* the glyph blitter alone, straight into the cell grid */
+    t0 = hosted_ns();
+    for (int i = 0; i < LINES * 80; i++)
+        draw_char_cell(i % 80, (i / 80) % 40, (unsigned short)(32 + i % 95));
+    fb_flush();
+    t1 = hosted_ns();
+    printf("printf cells   %d chars  %8.1f ns/char\n", LINES * 80, (double)(t1 - t0) / (80.0 * LINES));
+
+    /* a colour change every word, as a prompt or ls output does */
+    t0 = hosted_ns();
+    for (int i = 0; i < LINES * 10; i++) {
+        set_text_color(i & 1 ? 255 : 80, 255, i % 3 ? 255 : 80, 0, 0, 0);
+        k_printf("%s", text + 72);
+    }
+    set_text_color(255, 255, 255, 0, 0, 0);
+    fb_flush();
+    t1 = hosted_ns();
+    printf("printf colors  %d chars  %8.1f ns/char\n", LINES * 80, (double)(t1 - t0) / (80.0 * LINES));
+
+    /* what a shell prompt costs: one short line, then the flush the timer does */
+    t0 = hosted_ns();
+    for (int i = 0; i < LINES; i++) {
+        k_printf("> ls\n");
+        fb_flush();
+    }
+    t1 = hosted_ns();
+    printf("printf flush   %d lines  %8.1f us/line\n", LINES, (double)(t1 - t0) / (1000.0 * LINES));
+}
+
+static void bench_fill(void) {
+    enum { CLEARS = 200, RECTS = 20000 };
+    int w = vesa_mode_info.XResolution, h = vesa_mode_info.YResolution;
+    uint64_t t0 = hosted_ns();
+    for (int i = 0; i < CLEARS; i++) clear_screen((uint8_t)i, 0, 0);
+    uint64_t t1 = hosted_ns();
+    printf("fill clear     %dx%d     %8.1f us/clear\n", w, h, (double)(t1 - t0) / (1000.0 * CLEARS));
+
+    t0 = hosted_ns();
+    for (int i = 0; i < RECTS; i++) rectangle((i * 37) % w - 50, (i * 11) % h - 50, 100, 100, (uint8_t)i, 0, 0);
+    t1 = hosted_ns();
+    printf("fill rectangle 100x100     %8.1f ns/rect\n", (double)(t1 - t0) / RECTS);
+
+    t0 = hosted_ns();
+    for (int i = 0; i < RECTS; i++) draw_vline(i % w, 0, h, (uint8_t)i, 0, 0);
+    t1 = hosted_ns();
+    printf("fill vline     %d          %8.1f ns/line\n", h, (double)(t1 - t0) / RECTS);
+    fb_flush();
+}
+
+static void bench_blit(void) {
+    enum { SPRITES = 20000, FRAMES = 200 };
+    surface_t* screen = surface_screen();
+    surface_t* image = surface_create(screen->width, screen->height, screen->format);
+    surface_t* sprite = surface_create(64, 64, &fb_argb8888);
+    if (!image || !sprite) return;
+    memset(image->pixels, 0x5A, image->pitch * (size_t)image->height);
+    for (int y = 0; y < 64; y++)
+        for (int x = 0; x < 64; x++)
+            ((uint32_t*)(sprite->pixels + y * sprite->pitch))[x] = (uint32_t)(x * 4) << 24 | 0x00FF8040u;
+
+    uint64_t t0 = hosted_ns();
+    for (int i = 0; i < FRAMES; i++) surface_blit(screen, 0, 0, image, 0, 0, image->width, image->height);
+    uint64_t t1 = hosted_ns();
+    printf("blit screen    %dx%d     %8.1f us/frame\n", image->width, image->height, (double)(t1 - t0) / (1000.0 * FRAMES));
+
+    t0 = hosted_ns();
+    for (int i = 0; i < SPRITES; i++)
+        surface_blit_key(screen, (i * 37) % screen->width - 32, (i * 11) % screen->height - 32, sprite, 0, 0, 64, 64, 0x00FF8040u);
+    t1 = hosted_ns();
+    printf("blit key       64x64        %8.2f ns/pixel\n", (double)(t1 - t0) / (64.0 * 64 * SPRITES));
+
+    t0 = hosted_ns();
+    for (int i = 0; i < SPRITES; i++)
+        surface_blend(screen, (i * 37) % screen->width - 32, (i * 11) % screen->height - 32, sprite, 0, 0, 64, 64);
+    t1 = hosted_ns();
+    printf("blit blend     64x64        %8.2f ns/pixel\n", (double)(t1 - t0) / (64.0 * 64 * SPRITES));
+    fb_flush();
+    surface_destroy(sprite);
+    surface_destroy(image);
+}
+
+static void bench_raster(void) {
+    enum { SHAPES = 20000 };
+    int w = vesa_mode_info.XResolution, h = vesa_mode_info.YResolution;
+    uint64_t t0 = hosted_ns();
+    for (int i = 0; i < SHAPES; i++)
+        line((i * 37) % w, (i * 11) % h, (i * 37) % w + 100, (i * 11) % h + 60, (uint8_t)i, 0, 0, 10);
+    uint64_t t1 = hosted_ns();
+    printf("raster line    117x10       %8.1f ns/line\n", (double)(t1 - t0) / SHAPES);
+
+    t0 = hosted_ns();
+    for (int i = 0; i < SHAPES; i++) fill_circle((i * 37) % w, (i * 11) % h, 50, (uint8_t)i, 0, 0);
+    t1 = hosted_ns();
+    printf("raster circle  r50          %8.1f ns/circle\n", (double)(t1 - t0) / SHAPES);
+
+    t0 = hosted_ns();
+    for (int i = 0; i < SHAPES; i++) circle((i * 37) % w, (i * 11) % h, 50, (uint8_t)i, 0, 0);
+    t1 = hosted_ns();
+    printf("raster outline r50          %8.1f ns/circle\n", (double)(t1 - t0) / SHAPES);
+
+    /* a concave star, ten edges */
+    t0 = hosted_ns();
+    for (int i = 0; i < SHAPES; i++) {
+        int x = (i * 37) % w, y = (i * 11) % h;
+        point_t star[10] = {
+            { x, y - 50 }, { x + 12, y - 16 }, { x + 48, y - 15 }, { x + 19, y + 6 }, { x + 29, y + 40 },
+            { x, y + 20 }, { x - 29, y + 40 }, { x - 19, y + 6 }, { x - 48, y - 15 }, { x - 12, y - 16 },
+        };
+        fill_polygon(star, 10, (uint8_t)i, 0, 0);
+    }
+    t1 = hosted_ns();
+    printf("raster star    96x90        %8.1f ns/star\n", (double)(t1 - t0) / SHAPES);
+    fb_flush();
+}
+
+static void bench_klog(void) {
+    enum { RECORDS = 200000 };
+    /* DEBUG_PRINT's cost now: format into a ring slot, nothing drawn */
+    uint64_t t0 = hosted_ns();
+    for (int i = 0; i < RECORDS; i++)
+        klog(3, "[malloc] free_sized(%p, %u) on a %u byte block\n", (void*)(uintptr_t)i, (unsigned)i, 64u);
+    uint64_t t1 = hosted_ns();
+    printf("klog record    %d       %8.1f ns/record\n", RECORDS, (double)(t1 - t0) / RECORDS);
+
+    /* and what the idle loop pays later for the last ring's worth */
+    t0 = hosted_ns();
+    klog_drain();
+    fb_flush();
+    t1 = hosted_ns();
+    printf("klog drain     ring         %8.1f us\n", (double)(t1 - t0) / 1000.0);
+}
+
+static const struct {
+    const char* name;
+    void (*run)(void);
+} suites[] = {
+    { "mem", bench_mem },
+    { "str", bench_str },
+    { "malloc", bench_malloc },
+    { "printf", bench_printf },
+    { "fill", bench_fill },
+    { "blit", bench_blit },
+    { "raster", bench_raster },
+    { "klog", bench_klog },
+};
+
+int main(int argc, char** argv) {
+    int bpp = 32, named = 0;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "16") || !strcmp(argv[a], "24") || !strcmp(argv[a], "32")) bpp = atoi(argv[a]);
+        else named = 1;
+    }
+    hosted_init(1024, 768, bpp);
+
+    for (size_t i = 0; i < sizeof(suites) / sizeof(suites[0]); i++) {
+        int wanted = !named;
+        for (int a = 1; a < argc; a++)
+            if (!strcmp(argv[a], suites[i].name)) wanted = 1;
+        if (wanted) suites[i].run();
+    }
+    return 0;
+}
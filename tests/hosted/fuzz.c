@@ -0,0 +1,655 @@
+// tests/hosted/fuzz.c -- differential fuzzing of the kernel libc against glibc
+//
+//   make fuzz                                default run, at 32, 24 and 16 bpp
+//   tests/hosted/fuzz [iters] [seed] [bpp]   longer run / reproduce a failure
+//
+// String and memory functions get random lengths, alignments and contents
+// (strings placed right before an unmapped page too) and must agree with
+// glibc, so must snprintf for random conversions. malloc gets a random
+// alloc/realloc/free trace, the slab caches random create/alloc/free/
+// destroy, every block and object is filled with a pattern and checked
+// before it goes away. Blits and blends between random surfaces at
+// random, partly off-surface positions are checked pixel by pixel against a
+// plain model, so are filled polygons and ellipses. Random drawing goes
+// through the shadow framebuffer and, after a flush, the page of video
+// memory being scanned out has to match it exactly. The framebuffer is
+// 32, 24 or 16 bpp as asked, surfaces get all of those formats every run.
+// Exits 1 on the first mismatch, printing the seed, iteration and depth.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <vesa.h>
+#include <surface.h>
+#include <raster.h>
+#include <slab.h>
+#include "hosted.h"
+
+#define BUF 4096
+
+static uint64_t rng;
+static unsigned long iter;
+static unsigned long seed;
+static int bpp;
+
+static uint32_t rnd(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t)(rng >> 16);
+}
+
+/* small alphabet so searches hit as often as they miss */
+static void fill(unsigned char* p, size_t n) {
+    for (size_t i = 0; i < n; i++) p[i] = (unsigned char)("abcab\x80\xff"[rnd() % 7]);
+}
+
+static int sign(int v) { return (v > 0) - (v < 0); }
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "fuzz: seed %lu iter %lu %d bpp: ", seed, iter, bpp); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        exit(1); \
+    } \
+} while (0)
+
+static unsigned char a_k[BUF + 64], a_g[BUF + 64], src[BUF + 64];
+
+static size_t rnd_len(void) {
+    /* mostly short, sometimes long */
+    return (rnd() & 3) ? rnd() % 80 : rnd() % (BUF - 64);
+}
+
+static void fuzz_mem(void) {
+    size_t n = rnd_len();
+    size_t da = rnd() % 16, sa = rnd() % 16;
+    fill(src, sizeof(src));
+    fill(a_k, sizeof(a_k));
+    memcpy(a_g, a_k, sizeof(a_k));
+
+    switch (rnd() % 4) {
+    case 0:
+        k_memcpy(a_k + da, src + sa, n);
+        memcpy(a_g + da, src + sa, n);
+        CHECK(!memcmp(a_k, a_g, sizeof(a_k)), "memcpy n=%zu +%zu/+%zu", n, da, sa);
+        break;
+    case 1: {
+        int c = (int)rnd();
+        k_memset(a_k + da, c, n);
+        memset(a_g + da, c, n);
+        CHECK(!memcmp(a_k, a_g, sizeof(a_k)), "memset n=%zu +%zu", n, da);
+        break;
+    }
+    case 2: {
+        /* overlapping both ways */
+        size_t from = rnd() % 48, to = rnd() % 48;
+        k_memmove(a_k + to, a_k + from, n);
+        memmove(a_g + to, a_g + from, n);
+        CHECK(!memcmp(a_k, a_g, sizeof(a_k)), "memmove n=%zu %zu->%zu", n, from, to);
+        break;
+    }
+    case 3: {
+        memcpy(a_k + da, src + sa, n);
+        if (n && (rnd() & 1)) a_k[da + rnd() % n] ^= (unsigned char)(1u << (rnd() % 8));
+        int k = k_memcmp(a_k + da, src + sa, n);
+        int g = memcmp(a_k + da, src + sa, n);
+        CHECK(sign(k) == sign(g), "memcmp n=%zu: %d vs %d", n, k, g);
+        break;
+    }
+    }
+}
+
+/* a string that ends exactly before an unmapped page, word reads that go
+   one byte too far fault here instead of passing silently */
+static char* guard_page;
+
+static char* edge_string(size_t n) {
+    char* s = guard_page - n - 1;
+    fill((unsigned char*)s, n);
+    for (size_t i = 0; i < n; i++) if (!s[i]) s[i] = 'a';
+    s[n] = 0;
+    return s;
+}
+
+static char* rnd_string(unsigned char* buf, size_t* len) {
+    size_t off = rnd() % 16;
+    size_t n = rnd_len();
+    char* s = (char*)buf + off;
+    fill((unsigned char*)s, n);
+    s[n] = 0;
+    *len = n;
+    return s;
+}
+
+static void fuzz_str(void) {
+    size_t n1, n2;
+    char* s1 = (rnd() % 4) ? rnd_string(a_k, &n1) : edge_string(n1 = rnd() % 200);
+    char* s2 = rnd_string(src, &n2);
+    int c = (rnd() % 8) ? "abc\x80\xff"[rnd() % 5] : (int)(rnd() & 0xFF);
+
+    switch (rnd() % 8) {
+    case 0:
+        CHECK(k_strlen(s1) == strlen(s1), "strlen n=%zu", n1);
+        break;
+    case 1:
+        CHECK(k_strchr(s1, c) == strchr(s1, c), "strchr n=%zu c=%d", n1, c);
+        break;
+    case 2:
+        CHECK(k_strrchr(s1, c) == strrchr(s1, c), "strrchr n=%zu c=%d", n1, c);
+        break;
+    case 3: {
+        /* needle from the haystack most of the time so it is found */
+        char needle[80];
+        size_t nl = rnd() % 20;
+        if (n1 && (rnd() & 1)) {
+            size_t at = rnd() % n1;
+            if (nl > n1 - at) nl = n1 - at;
+            memcpy(needle, s1 + at, nl);
+        } else {
+            fill((unsigned char*)needle, nl);
+        }
+        needle[nl] = 0;
+        CHECK(k_strstr(s1, needle) == strstr(s1, needle), "strstr n=%zu needle=%zu", n1, strlen(needle));
+        break;
+    }
+    case 4: {
+        if (n1 && (rnd() & 1)) {
+            /* same prefix, then maybe a difference */
+            size_t m = n1 < n2 ? n1 : n2;
+            memcpy(s2, s1, m);
+        }
+        int k = k_strcmp(s1, s2), g = strcmp(s1, s2);
+        CHECK(sign(k) == sign(g), "strcmp %zu/%zu: %d vs %d", n1, n2, k, g);
+        size_t lim = rnd() % 100;
+        k = k_strncmp(s1, s2, lim);
+        g = strncmp(s1, s2, lim);
+        CHECK(sign(k) == sign(g), "strncmp %zu/%zu/%zu: %d vs %d", n1, n2, lim, k, g);
+        break;
+    }
+    case 5: {
+        static char dk[BUF * 2 + 64], dg[BUF * 2 + 64];
+        memset(dk, 1, sizeof(dk));
+        memset(dg, 1, sizeof(dg));
+        size_t lim = rnd() % 100;
+        /* the kernel strncpy always terminates (dst[min(len, n)]) and does
+           not pad, which is what its callers want; check that, not ISO C */
+        k_strncpy(dk, s1, lim);
+        if (lim) {
+            size_t m = strnlen(s1, lim);
+            memcpy(dg, s1, m);
+            dg[m] = 0;
+        }
+        CHECK(!memcmp(dk, dg, sizeof(dk)), "strncpy n=%zu lim=%zu", n1, lim);
+        k_strcpy(dk, s1);
+        strcpy(dg, s1);
+        k_strcat(dk, s2);
+        strcat(dg, s2);
+        CHECK(!memcmp(dk, dg, sizeof(dk)), "strcpy/strcat %zu+%zu", n1, n2);
+        k_strncat(dk, s1, lim);
+        strncat(dg, s1, lim);
+        CHECK(!memcmp(dk, dg, sizeof(dk)), "strncat lim=%zu", lim);
+        break;
+    }
+    case 6: {
+        /* plain digits in range, the kernel strtoul is 32-bit and stops at base 16 */
+        static const int bases[] = { 10, 16, 2, 8 };
+        int base = bases[rnd() % 4];
+        char num[16];
+        unsigned long v = rnd();
+        int len = 0;
+        do { num[len++] = "0123456789abcdef"[v % (unsigned long)base]; v /= (unsigned long)base; } while (v && len < 6);
+        num[len] = 0;
+        char *ek, *eg;
+        unsigned long k = k_strtoul(num, &ek, base), g = strtoul(num, &eg, base);
+        CHECK(k == g && ek - num == eg - num, "strtoul \"%s\" base %d: %lu vs %lu", num, base, k, g);
+        break;
+    }
+    case 7:
+        CHECK(k_strcmp(s1, s1) == 0, "strcmp self n=%zu", n1);
+        break;
+    }
+}
+
+#define SLOTS 512
+
+static struct { unsigned char* p; size_t n; unsigned char tag; } slots[SLOTS];
+
+static void check_block(int s) {
+    for (size_t i = 0; i < slots[s].n; i++)
+        CHECK(slots[s].p[i] == (unsigned char)(slots[s].tag + i), "heap block %p (%zu bytes) corrupted at %zu",
+              (void*)slots[s].p, slots[s].n, i);
+}
+
+static void stamp_block(int s) {
+    for (size_t i = 0; i < slots[s].n; i++) slots[s].p[i] = (unsigned char)(slots[s].tag + i);
+}
+
+static void fuzz_malloc(void) {
+    int s = (int)(rnd() % SLOTS);
+    size_t n = (rnd() & 7) ? rnd() % 512 : rnd() % 100000;
+
+    if (!slots[s].p) {
+        if (rnd() & 1) {
+            size_t align = (size_t)16 << (rnd() % 8);
+            slots[s].p = k_aligned_alloc(align, n);
+            CHECK(slots[s].p && !((uintptr_t)slots[s].p & (align - 1)), "aligned_alloc(%zu, %zu)", align, n);
+        } else {
+            slots[s].p = k_malloc(n);
+            CHECK(slots[s].p, "malloc(%zu) failed", n);
+        }
+        CHECK(k_malloc_usable_size(slots[s].p) >= n, "usable size %zu < %zu",
+              k_malloc_usable_size(slots[s].p), n);
+        slots[s].n = n;
+        slots[s].tag = (unsigned char)rnd();
+        stamp_block(s);
+    } else if (rnd() & 1) {
+        check_block(s);
+        unsigned char* p = k_realloc(slots[s].p, n);
+        CHECK(p || !n, "realloc(%zu) failed", n);
+        size_t keep = n < slots[s].n ? n : slots[s].n;
+        slots[s].p = p;
+        slots[s].n = keep;
+        check_block(s);
+        slots[s].n = n;
+        stamp_block(s);
+        if (!n) { k_free(p); slots[s].p = NULL; }
+    } else {
+        check_block(s);
+        k_free(slots[s].p);
+        slots[s].p = NULL;
+    }
+}
+
+/* kmem caches of random size and alignment, half of them with a
+   constructor. Objects are stamped like heap blocks while in use; a cache
+   with a ctor gets them back in the state the ctor left, which the
+   allocation checks */
+#define SLAB_CACHES 8
+#define SLAB_OBJS   64
+
+static struct {
+    kmem_cache_t* c;
+    size_t size, align;
+    int ctor;
+    unsigned char* obj[SLAB_OBJS];
+    unsigned char tag[SLAB_OBJS];
+} caches[SLAB_CACHES];
+
+static void slab_ctor_fill(int i, void* p) {
+    for (size_t k = 0; k < caches[i].size; k++) ((unsigned char*)p)[k] = (unsigned char)(i * 37 + k);
+}
+
+static int slab_ctor_ok(int i, const unsigned char* p) {
+    for (size_t k = 0; k < caches[i].size; k++)
+        if (p[k] != (unsigned char)(i * 37 + k)) return 0;
+    return 1;
+}
+
+#define SLAB_CTOR(i) static void slab_ctor##i(void* p) { slab_ctor_fill(i, p); }
+SLAB_CTOR(0) SLAB_CTOR(1) SLAB_CTOR(2) SLAB_CTOR(3)
+SLAB_CTOR(4) SLAB_CTOR(5) SLAB_CTOR(6) SLAB_CTOR(7)
+static void (*const slab_ctors[SLAB_CACHES])(void*) = {
+    slab_ctor0, slab_ctor1, slab_ctor2, slab_ctor3, slab_ctor4, slab_ctor5, slab_ctor6, slab_ctor7,
+};
+
+static void slab_check(int i, int o) {
+    const unsigned char* p = caches[i].obj[o];
+    for (size_t k = 0; k < caches[i].size; k++)
+        CHECK(p[k] == (unsigned char)(caches[i].tag[o] + k), "cache %d (%zu bytes, align %zu%s) object %p corrupted at %zu",
+              i, caches[i].size, caches[i].align, caches[i].ctor ? ", ctor" : "", (void*)p, k);
+}
+
+/* check the object and hand it back, constructed again if the cache wants that */
+static void slab_put(int i, int o) {
+    slab_check(i, o);
+    if (caches[i].ctor) slab_ctor_fill(i, caches[i].obj[o]);
+    kmem_cache_free(caches[i].c, caches[i].obj[o]);
+    caches[i].obj[o] = NULL;
+}
+
+static void slab_destroy_cache(int i) {
+    for (int o = 0; o < SLAB_OBJS; o++)
+        if (caches[i].obj[o]) slab_put(i, o);
+    kmem_cache_destroy(caches[i].c);
+    caches[i].c = NULL;
+}
+
+static void fuzz_slab(void) {
+    int i = (int)(rnd() % SLAB_CACHES);
+    if (!caches[i].c) {
+        caches[i].size = (rnd() & 3) ? 1 + rnd() % 256 : 1 + rnd() % 7000;
+        caches[i].align = (rnd() & 1) ? (size_t)1 << (rnd() % 9) : 0;
+        caches[i].ctor = rnd() & 1;
+        caches[i].c = kmem_cache_create("fuzz", caches[i].size, caches[i].align,
+                                        caches[i].ctor ? slab_ctors[i] : NULL);
+        CHECK(caches[i].c, "kmem_cache_create(%zu, %zu) failed", caches[i].size, caches[i].align);
+        return;
+    }
+    if (rnd() % 256 == 0) {
+        slab_destroy_cache(i);
+        return;
+    }
+
+    int o = (int)(rnd() % SLAB_OBJS);
+    if (caches[i].obj[o]) {
+        slab_put(i, o);
+        return;
+    }
+    unsigned char* p = kmem_cache_alloc(caches[i].c);
+    size_t align = caches[i].align > sizeof(void*) ? caches[i].align : sizeof(void*);
+    CHECK(p, "kmem_cache_alloc(%zu bytes) failed", caches[i].size);
+    CHECK(!((uintptr_t)p & (align - 1)), "cache %d object %p not aligned to %zu", i, (void*)p, align);
+    CHECK(!caches[i].ctor || slab_ctor_ok(i, p), "cache %d object %p not in its constructed state", i, (void*)p);
+    caches[i].obj[o] = p;
+    caches[i].tag[o] = (unsigned char)rnd();
+    for (size_t k = 0; k < caches[i].size; k++) p[k] = (unsigned char)(caches[i].tag[o] + k);
+}
+
+/* one random conversion between literal text, output and return value
+   must match glibc, also when cut off by a small buffer */
+static void fuzz_fmt(void) {
+    static const char convs[] = "diuxXobcs%";
+    static const char* lens[] = { "", "l", "ll", "z" };
+    char fmt[64], out_k[256], out_g[256], str[24];
+    char conv = convs[rnd() % (sizeof(convs) - 1)];
+    const char* len = (conv == 'c' || conv == 's' || conv == '%') ? "" : lens[rnd() % 4];
+
+    char* f = fmt;
+    *f++ = 'a';
+    *f++ = '%';
+    for (int i = 0; i < 5; i++) {
+        if (rnd() & 3) continue;
+        char flag = "-+ 0#"[i];
+        if (flag == '0' && (conv == 'c' || conv == 's')) continue;
+        *f++ = flag;
+    }
+    if (rnd() & 1) f += sprintf(f, "%u", rnd() % 24);
+    if (rnd() & 1) f += sprintf(f, ".%u", rnd() % 14);
+    f += sprintf(f, "%s%c/z", len, conv);
+
+    unsigned long long v = ((unsigned long long)rnd() << 32 | rnd()) >> (rnd() % 64);
+    if (rnd() & 1) v = -v;
+    size_t slen = rnd() % sizeof(str);
+    for (size_t i = 0; i < slen; i++) str[i] = (char)('a' + rnd() % 26);
+    str[slen] = '\0';
+
+    size_t size = (rnd() & 3) ? sizeof(out_k) : rnd() % 24;
+    int rk, rg;
+    memset(out_k, 0x5A, sizeof(out_k));
+    memset(out_g, 0x5A, sizeof(out_g));
+    switch (conv) {
+        case 'c': rk = k_snprintf(out_k, size, fmt, 'A' + (int)(v % 26));
+                  rg = snprintf(out_g, size, fmt, 'A' + (int)(v % 26)); break;
+        case 's': rk = k_snprintf(out_k, size, fmt, str);
+                  rg = snprintf(out_g, size, fmt, str); break;
+        case '%': rk = k_snprintf(out_k, size, fmt);
+                  rg = snprintf(out_g, size, fmt); break;
+        default:
+            if (!*len) { rk = k_snprintf(out_k, size, fmt, (int)v); rg = snprintf(out_g, size, fmt, (int)v); }
+            else if (len[1] == 'l') { rk = k_snprintf(out_k, size, fmt, v); rg = snprintf(out_g, size, fmt, v); }
+            else if (*len == 'l') { rk = k_snprintf(out_k, size, fmt, (long)v); rg = snprintf(out_g, size, fmt, (long)v); }
+            else { rk = k_snprintf(out_k, size, fmt, (size_t)v); rg = snprintf(out_g, size, fmt, (size_t)v); }
+            break;
+    }
+    CHECK(rk == rg && !memcmp(out_k, out_g, sizeof(out_k)),
+          "snprintf(%zu, \"%s\") returned %d \"%.*s\", glibc %d \"%.*s\"",
+          size, fmt, rk, (int)(size ? strnlen(out_k, size) : 0), out_k, rg, (int)(size ? strnlen(out_g, size) : 0), out_g);
+}
+
+/* a pixel of `bytes` bytes as a number, little endian like the formats store it */
+static uint32_t pixel_at(const uint8_t* p, size_t bytes) {
+    uint32_t v = 0;
+    for (size_t b = 0; b < bytes; b++) v |= (uint32_t)p[b] << 8 * b;
+    return v;
+}
+
+static void pixel_put(uint8_t* p, size_t bytes, uint32_t v) {
+    for (size_t b = 0; b < bytes; b++) p[b] = (uint8_t)(v >> 8 * b);
+}
+
+/* what color() makes of an xrgb pixel in a 24 or 16 bit format */
+static uint32_t narrow(const fb_ops_t* f, uint32_t s) {
+    if (f == &fb_rgb888) return s & 0xFFFFFF;
+    return (s >> 19 & 0x1F) << 11 | (s >> 10 & 0x3F) << 5 | (s >> 3 & 0x1F);
+}
+
+/* blit, keyed blit or blend of random surfaces, argb/xrgb into any of
+   argb, xrgb, rgb888 and rgb565 or 24/16 bit into their own format, then
+   every pixel of dst checked against what the operation should have done */
+static void fuzz_surface(void) {
+    static const fb_ops_t* const dsts[] = { &fb_argb8888, &fb_xrgb8888, &fb_rgb888, &fb_rgb565 };
+    int sw = 1 + (int)(rnd() % 40), sh = 1 + (int)(rnd() % 40);
+    int dw = 1 + (int)(rnd() % 40), dh = 1 + (int)(rnd() % 40);
+    const fb_ops_t* df = dsts[rnd() % 4];
+    const fb_ops_t* sf = (rnd() & 3) ? &fb_argb8888 : &fb_xrgb8888;
+    if (df->bytes < 4 && !(rnd() & 3)) sf = df;
+    surface_t* src = surface_create(sw, sh, sf);
+    surface_t* dst = surface_create(dw, dh, df);
+    CHECK(src && dst, "surface_create failed");
+
+    static const uint8_t alphas[] = { 0, 0, 1, 127, 128, 200, 254, 255, 255, 255 };
+    uint32_t mask = sf->bytes < 4 ? ((uint32_t)1 << 8 * sf->bytes) - 1 : 0xFFFFFFFFu;
+    uint32_t key = rnd() & mask;
+    for (int y = 0; y < sh; y++)
+        for (int x = 0; x < sw; x++) {
+            uint32_t v = (rnd() & 0xFFFFFF) | (uint32_t)alphas[rnd() % sizeof(alphas)] << 24;
+            pixel_put(src->pixels + y * src->pitch + x * sf->bytes, sf->bytes, ((rnd() % 5) ? v : key) & mask);
+        }
+    static uint32_t before[40 * 40];
+    for (int y = 0; y < dh; y++)
+        for (int x = 0; x < dw; x++) {
+            uint8_t* p = dst->pixels + y * dst->pitch + x * df->bytes;
+            pixel_put(p, df->bytes, rnd());
+            before[y * dw + x] = pixel_at(p, df->bytes);
+        }
+
+    int sx = (int)(rnd() % 60) - 10, sy = (int)(rnd() % 60) - 10;
+    int dx = (int)(rnd() % 60) - 10, dy = (int)(rnd() % 60) - 10;
+    int w = (int)(rnd() % 50) - 2, h = (int)(rnd() % 50) - 2;
+    int op = (int)(rnd() % 3);
+    if (op == 2 && sf != &fb_argb8888) op = 0;
+    switch (op) {
+        case 0: surface_blit(dst, dx, dy, src, sx, sy, w, h); break;
+        case 1: surface_blit_key(dst, dx, dy, src, sx, sy, w, h, key); break;
+        case 2: surface_blend(dst, dx, dy, src, sx, sy, w, h); break;
+    }
+
+    for (int y = 0; y < dh; y++)
+        for (int x = 0; x < dw; x++) {
+            uint32_t d = before[y * dw + x], want = d;
+            int u = x - dx + sx, v = y - dy + sy;
+            if (u >= sx && u < sx + w && v >= sy && v < sy + h && u >= 0 && v >= 0 && u < sw && v < sh) {
+                uint32_t s = pixel_at(src->pixels + v * src->pitch + u * sf->bytes, sf->bytes);
+                /* xrgb into argb goes through color(), which makes it opaque */
+                uint32_t copy = sf == df ? s
+                              : df->bytes < 4 ? narrow(df, s)
+                              : (sf == &fb_xrgb8888 && df == &fb_argb8888) ? (s | 0xFF000000u) : s;
+                if (op == 0) {
+                    want = copy;
+                } else if (op == 1) {
+                    if (s != key) want = copy;
+                } else if (df->bytes < 4) {
+                    /* no blending below 32 bit, just the mostly opaque pixels */
+                    if (s >> 24 >= 128) want = copy;
+                } else {
+                    uint32_t a = s >> 24;
+                    want = 0;
+                    for (int c = 0; c < 32; c += 8) {
+                        /* the alpha byte blends as if the source were opaque */
+                        uint32_t sc = c == 24 ? 255 : (s >> c & 0xFF);
+                        uint32_t t = sc * a + (d >> c & 0xFF) * (255 - a) + 128;
+                        want |= ((t + (t >> 8)) >> 8) << c;
+                    }
+                }
+            }
+            uint32_t got = pixel_at(dst->pixels + y * dst->pitch + x * df->bytes, df->bytes);
+            CHECK(got == want, "surface op %d %s->%s src %dx%d dst %dx%d (%d,%d)->(%d,%d) %dx%d: pixel %d,%d is %08X, want %08X",
+                  op, sf->name, df->name, sw, sh, dw, dh, sx, sy, dx, dy, w, h, x, y, got, want);
+        }
+    surface_destroy(src);
+    surface_destroy(dst);
+}
+
+/* a filled polygon or ellipse on a cleared patch (sometimes hanging off the
+   screen), then every pixel of the patch against the shape's own rule: the
+   winding number at the pixel centre, or the ellipse inequality */
+static void fuzz_raster(void) {
+    int w = vesa_mode_info.XResolution, h = vesa_mode_info.YResolution;
+    int ox = (rnd() & 1) ? (int)(rnd() % (w - 64)) : ((rnd() & 1) ? -20 : w - 44);
+    int oy = (rnd() & 1) ? (int)(rnd() % (h - 64)) : ((rnd() & 1) ? -20 : h - 44);
+    /* distinct channels so a span that puts bytes in the wrong place shows;
+       red never rounds away, so the shape is never the colour of the patch */
+    uint8_t cr = (uint8_t)(rnd() | 0x80), cg = (uint8_t)rnd(), cb = (uint8_t)rnd();
+    uint32_t on = vesa_color(cr, cg, cb);
+    rectangle(ox, oy, 64, 64, 0, 0, 0);
+
+    point_t pts[8];
+    int n = 0, cx = 0, cy = 0, rx = 0, ry = 0;
+    int64_t a = 0, b = 0;
+    int ell = rnd() & 1;
+    if (ell) {
+        rx = (int)(rnd() % 30);
+        ry = (rnd() & 1) ? rx : (int)(rnd() % 30);
+        cx = ox + 32 + (int)(rnd() % 5) - 2;
+        cy = oy + 32 + (int)(rnd() % 5) - 2;
+        a = (int64_t)(2 * rx + 1) * (2 * rx + 1);
+        b = (int64_t)(2 * ry + 1) * (2 * ry + 1);
+        fill_ellipse(cx, cy, rx, ry, cr, cg, cb);
+    } else {
+        n = 3 + (int)(rnd() % 6);
+        for (int i = 0; i < n; i++) {
+            pts[i].x = ox + 4 + (int)(rnd() % 57);
+            pts[i].y = oy + 4 + (int)(rnd() % 57);
+        }
+        fill_polygon(pts, n, cr, cg, cb);
+    }
+
+    const uint8_t* fb = fb_target();
+    for (int y = oy; y < oy + 64; y++)
+        for (int x = ox; x < ox + 64; x++) {
+            if (x < 0 || y < 0 || x >= w || y >= h) continue;
+            int in = 0;
+            if (ell) {
+                int64_t dx = x - cx, dy = y - cy;
+                in = 4 * dx * dx * b + 4 * dy * dy * a <= a * b;
+            } else {
+                /* doubled, so the centre is (2x + 1, 2y + 1) */
+                int64_t px = 2 * x + 1, py = 2 * y + 1;
+                int wn = 0;
+                for (int i = 0; i < n; i++) {
+                    int64_t ax = 2 * pts[i].x, ay = 2 * pts[i].y;
+                    int64_t bx = 2 * pts[(i + 1) % n].x, by = 2 * pts[(i + 1) % n].y;
+                    int64_t cross = (bx - ax) * (py - ay) - (px - ax) * (by - ay);
+                    if (ay < py && by > py && cross > 0) wn++;
+                    else if (ay > py && by < py && cross < 0) wn--;
+                }
+                in = wn != 0;
+            }
+            uint32_t got = pixel_at(fb + (size_t)y * vesa_mode_info.BytesPerScanLine + (size_t)x * fb_ops->bytes,
+                                    fb_ops->bytes);
+            CHECK(got == (in ? on : 0), "%s at (%d,%d): pixel %d,%d is %06X, want %s",
+                  ell ? "fill_ellipse" : "fill_polygon", ell ? cx : pts[0].x, ell ? cy : pts[0].y,
+                  x, y, got, in ? "set" : "clear");
+        }
+}
+
+/* anything the damage tracking misses shows up as a difference after the flush */
+static void fuzz_fb(void) {
+    static unsigned int ops = 0;
+    int w = vesa_mode_info.XResolution, h = vesa_mode_info.YResolution;
+    uint8_t c = (uint8_t)rnd();
+
+    switch (rnd() % 10) {
+        case 0: set_pixel((int)(rnd() % (w + 20)) - 10, (int)(rnd() % (h + 20)) - 10, c, c ^ 0x55, c); break;
+        case 1: rectangle((int)(rnd() % w) - 20, (int)(rnd() % h) - 20, (int)(rnd() % 90), (int)(rnd() % 90), c, 1, 2); break;
+        case 2: line((int)(rnd() % w), (int)(rnd() % h), (int)(rnd() % w), (int)(rnd() % h), 3, c, 4, (int)(rnd() % 16)); break;
+        case 3: circle((int)(rnd() % w), (int)(rnd() % h), (int)(rnd() % 60), c, c, 9); break;
+        case 4: draw_char_cell((int)(rnd() % 90), (int)(rnd() % 40), (unsigned short)(rnd() % 256)); break;
+        case 5: k_printf((rnd() & 3) ? "%u " : "%u\n", rnd()); break;
+        case 6: {
+            /* escape sequence soup: whatever comes in, the parser has to stay in bounds */
+            static const char soup[] = "\x1b\x1b\x1b[[[;;0123456789?HfJKXLMSTrsumABCDEFGd78\n\r\b\tx\x85";
+            char seq[24];
+            size_t n = rnd() % sizeof(seq);
+            for (size_t i = 0; i < n; i++) seq[i] = soup[rnd() % (sizeof(soup) - 1)];
+            k_printf("%.*s", (int)n, seq);
+            break;
+        }
+        case 7: scrollback_page((int)(rnd() % 5) - 2); break;
+        case 8: ((rnd() & 1) ? ellipse : fill_ellipse)((int)(rnd() % w), (int)(rnd() % h),
+                                                       (int)(rnd() % 90), (int)(rnd() % 90), c, 7, c); break;
+        case 9: {
+            point_t pts[6];
+            for (int i = 0; i < 6; i++) {
+                pts[i].x = (int)(rnd() % (w + 100)) - 50;
+                pts[i].y = (int)(rnd() % (h + 100)) - 50;
+            }
+            if (rnd() & 1) fill_polygon(pts, 3 + (int)(rnd() % 4), c, 5, 6);
+            else polygon(pts, 3 + (int)(rnd() % 4), c, 5, 6, (int)(rnd() % 12));
+            break;
+        }
+    }
+    /* flushes in between, unchecked, so pages get flipped and scrolled
+       with damage of every size */
+    if (++ops % 16 == 0) fb_flush();
+    if (ops % 512) return;
+
+    fb_flush();
+    size_t pitch = vesa_mode_info.BytesPerScanLine;
+    size_t row = (size_t)w * ((vesa_mode_info.BitsPerPixel + 7) / 8);
+    int top = hosted_scanout_row();
+    const uint8_t* vram = (const uint8_t*)(uintptr_t)vesa_mode_info.PhysBasePtr + (size_t)top * pitch;
+    const uint8_t* shadow = fb_target();
+    for (int y = 0; y < h; y++)
+        CHECK(!memcmp(vram + y * pitch, shadow + y * pitch, row),
+              "framebuffer row %d differs after flush (scanout from row %d)", y, top);
+}
+
+int main(int argc, char** argv) {
+    unsigned long iters = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000000;
+    seed = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+    bpp = argc > 3 ? (int)strtoul(argv[3], NULL, 0) : 32;
+    rng = seed * 0x9E3779B97F4A7C15ull + 1;
+    if (bpp != 16 && bpp != 24 && bpp != 32) {
+        fprintf(stderr, "fuzz: %d bpp, not 16, 24 or 32\n", bpp);
+        return 2;
+    }
+
+    hosted_init(640, 480, bpp);
+
+    long page = sysconf(_SC_PAGESIZE);
+    char* pages = mmap(NULL, (size_t)page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED) { perror("mmap"); return 2; }
+    guard_page = pages + page;
+    mprotect(guard_page, (size_t)page, PROT_NONE);
+
+    for (iter = 0; iter < iters; iter++) {
+        switch (rnd() % 8) {
+            case 0: fuzz_mem(); break;
+            case 1: fuzz_str(); break;
+            case 2: fuzz_malloc(); break;
+            case 3: fuzz_fb(); break;
+            case 4: fuzz_fmt(); break;
+            case 5: fuzz_surface(); break;
+            case 6: fuzz_raster(); break;
+            case 7: fuzz_slab(); break;
+        }
+    }
+    for (int s = 0; s < SLOTS; s++) {
+        if (!slots[s].p) continue;
+        check_block(s);
+        k_free(slots[s].p);
+    }
+    for (int i = 0; i < SLAB_CACHES; i++)
+        if (caches[i].c) slab_destroy_cache(i);
+    printf("fuzz: %lu iterations, seed %lu, %d bpp, ok\n", iters, seed, bpp);
+    return 0;
+}
@@ -0,0 +1,57 @@
+// tests/hosted/hosted.h -- what the bench and fuzz programs see of the kernel
+//
+// The kernel's libc is linked into a normal Linux process (see rename.h for
+// how the names are kept apart from glibc). The framebuffer is plain memory
+// and the page allocator hands out mmap()ed chunks, so malloc, the string
+// functions and the text engine run unmodified.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+void* k_malloc(size_t size);
+void  k_free(void* ptr);
+void* k_calloc(size_t n, size_t size);
+void* k_realloc(void* ptr, size_t size);
+void* k_aligned_alloc(size_t alignment, size_t size);
+size_t k_malloc_usable_size(void* ptr);
+
+void* k_memcpy(void* dest, const void* src, size_t n);
+void* k_memmove(void* dest, const void* src, size_t n);
+void* k_memset(void* dest, int c, size_t n);
+int   k_memcmp(const void* a, const void* b, size_t n);
+size_t k_strlen(const char* s);
+char* k_strcpy(char* dest, const char* src);
+char* k_strncpy(char* dest, const char* src, size_t n);
+char* k_strcat(char* dest, const char* src);
+char* k_strncat(char* dest, const char* src, size_t n);
+int   k_strcmp(const char* a, const char* b);
+int   k_strncmp(const char* a, const char* b, size_t n);
+char* k_strchr(const char* s, int c);
+char* k_strrchr(const char* s, int c);
+char* k_strstr(const char* haystack, const char* needle);
+unsigned long k_strtoul(const char* s, char** end, int base);
+
+int k_printf(const char* fmt, ...);
+int k_snprintf(char* buf, size_t size, const char* fmt, ...);
+
+void klog(int level, const char* fmt, ...);
+void klog_drain(void);
+
+// kernel init the harness has to run itself (main() does it on real hardware)
+void init_font(void);
+void text_init(void);
+void draw_char_cell(int cx, int cy, unsigned short code);
+void set_text_color(uint8_t fr, uint8_t fg, uint8_t fb, uint8_t br, uint8_t bg, uint8_t bb);
+void fb_flush(void);
+void scrollback_page(int pages);
+
+// fake a width x height x bpp linear framebuffer (below 4 GB, PhysBasePtr is
+// 32 bits) with three pages of fake DISPI video memory behind it, and bring
+// the text console up on it, shadowed and page flipped like under QEMU
+void hosted_init(int width, int height, int bpp);
+
+// the row of video memory the fake DISPI scans out from
+int hosted_scanout_row(void);
+
+// monotonic time in nanoseconds
+uint64_t hosted_ns(void);
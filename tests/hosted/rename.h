@@ -0,0 +1,36 @@
+// tests/hosted/rename.h -- force-included into every kernel source of the
+// hosted build (-include). The kernel defines its own libc; on the host those
+// names belong to glibc, so the kernel copies get a k_ prefix and the harness
+// calls them by that name (see hosted.h).
+#pragma once
+
+#define HOSTED 1
+
+#define malloc              k_malloc
+#define free                k_free
+#define calloc              k_calloc
+#define realloc             k_realloc
+#define aligned_alloc       k_aligned_alloc
+#define malloc_usable_size  k_malloc_usable_size
+
+#define memcpy              k_memcpy
+#define memmove             k_memmove
+#define memset              k_memset
+#define memcmp              k_memcmp
+#define strlen              k_strlen
+#define strcpy              k_strcpy
+#define strncpy             k_strncpy
+#define strcat              k_strcat
+#define strncat             k_strncat
+#define strcmp              k_strcmp
+#define strncmp             k_strncmp
+#define strchr              k_strchr
+#define strrchr             k_strrchr
+#define strstr              k_strstr
+#define strtok              k_strtok
+#define strtoul             k_strtoul
+
+#define printf              k_printf
+#define vprintf             k_vprintf
+#define snprintf            k_snprintf
+#define vsnprintf           k_vsnprintf
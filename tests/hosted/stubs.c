@@ -0,0 +1,127 @@
+// tests/hosted/stubs.c -- the bits of the machine the hosted build fakes
+//
+// Compiled without rename.h: this file talks to glibc and only fills in what
+// the kernel sources expect from the boot code, the linker script and the
+// page allocator.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <vesa.h>
+#include <pmm.h>
+#include <cpu.h>
+#include <dispi.h>
+#include <klog.h>
+#include "hosted.h"
+
+/* linker.ld gives the kernel a 256 KiB boot heap, so does this; anything
+   bigger goes through pmm_alloc_pages() like on real hardware */
+__asm__(".bss\n"
+        ".globl _heap_start, _heap_end\n"
+        ".balign 4096\n"
+        "_heap_start: .skip 0x40000\n"
+        "_heap_end:\n"
+        ".text\n");
+
+extern uint8_t base_font[256][16];
+
+/* idt.c's PIT counter, klog.c stamps records with it */
+volatile uint32_t timer_ticks = 0;
+
+/* from the host linker, the whole text segment */
+extern char __executable_start[];
+extern char etext[];
+
+void* pmm_alloc_pages(unsigned int order) {
+    if (order > PMM_MAX_ORDER) return NULL;
+    void* p = mmap(NULL, (size_t)PAGE_SIZE << order, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void pmm_free_pages(void* addr, unsigned int order) {
+    if (addr) munmap(addr, (size_t)PAGE_SIZE << order);
+}
+
+/* std-vga's DISPI as far as fb_pages_init() uses it: video memory is
+   HOSTED_PAGES screens tall and the scanout offset is only remembered */
+#define HOSTED_PAGES 3
+
+static int dispi_rows, dispi_offset;
+
+int dispi_init(int rows) {
+    return rows < dispi_rows ? rows : dispi_rows;
+}
+
+void dispi_set_y_offset(int y) {
+    dispi_offset = y;
+}
+
+int hosted_scanout_row(void) {
+    return dispi_offset;
+}
+
+void hosted_init(int width, int height, int bpp) {
+    size_t pitch = (size_t)width * (size_t)(bpp / 8);
+    dispi_rows = height * HOSTED_PAGES;
+    void* fb = mmap(NULL, pitch * (size_t)dispi_rows, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (fb == MAP_FAILED) {
+        perror("mmap framebuffer");
+        exit(2);
+    }
+
+    memset(&vesa_mode_info, 0, sizeof(vesa_mode_info));
+    vesa_mode_info.XResolution = (uint16_t)width;
+    vesa_mode_info.YResolution = (uint16_t)height;
+    vesa_mode_info.BitsPerPixel = (uint8_t)bpp;
+    vesa_mode_info.BytesPerScanLine = (uint16_t)pitch;
+    vesa_mode_info.PhysBasePtr = (uint32_t)(uintptr_t)fb;
+    vesa_vram_bytes = (uint32_t)(pitch * (size_t)dispi_rows);
+    if (bpp == 16) {
+        vesa_mode_info.RedMaskSize = 5;   vesa_mode_info.RedMaskPos = 11;
+        vesa_mode_info.GreenMaskSize = 6; vesa_mode_info.GreenMaskPos = 5;
+        vesa_mode_info.BlueMaskSize = 5;  vesa_mode_info.BlueMaskPos = 0;
+    } else {
+        vesa_mode_info.RedMaskSize = 8;   vesa_mode_info.RedMaskPos = 16;
+        vesa_mode_info.GreenMaskSize = 8; vesa_mode_info.GreenMaskPos = 8;
+        vesa_mode_info.BlueMaskSize = 8;  vesa_mode_info.BlueMaskPos = 0;
+    }
+
+    /* entry.s copies the BIOS 8x16 font here, any bit pattern will do */
+    for (int g = 0; g < 256; g++)
+        for (int row = 0; row < 16; row++)
+            base_font[g][row] = (uint8_t)(g * 31 + row * 17);
+
+    /* cpu_init() minus the ring 0 part (the host has SSE on); text is
+       read-only here, so it is opened up for the alternatives patching */
+    uintptr_t page = 4096;
+    uintptr_t start = (uintptr_t)__executable_start & ~(page - 1);
+    uintptr_t end = ((uintptr_t)etext + page - 1) & ~(page - 1);
+    if (mprotect((void*)start, end - start, PROT_READ | PROT_WRITE | PROT_EXEC)) {
+        perror("mprotect text");
+        exit(2);
+    }
+    cpu_detect();
+    alternatives_apply();
+    mprotect((void*)start, end - start, PROT_READ | PROT_EXEC);
+
+    klog_init();
+    vesa_init();
+    fb_shadow_init();
+    fb_pages_init();
+    init_font();
+    text_init();
+}
+
+uint64_t hosted_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}